@@ -3277,12 +3277,17 @@ struct UnitDiffT : public flatbuffers::NativeTable {
   double velocityX;
   double velocityY;
   int64_t flags;
+  uint64_t var_mask;
+  std::vector<uint8_t> var_deltas;
+  uint8_t skipped;
   UnitDiffT()
       : id(0),
         order_size(0),
         velocityX(0.0),
         velocityY(0.0),
-        flags(0) {
+        flags(0),
+        var_mask(0),
+        skipped(0) {
   }
 };
 
@@ -3297,7 +3302,10 @@ struct UnitDiff FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_ORDER_SIZE = 14,
     VT_VELOCITYX = 16,
     VT_VELOCITYY = 18,
-    VT_FLAGS = 20
+    VT_FLAGS = 20,
+    VT_VAR_MASK = 22,
+    VT_VAR_DELTAS = 24,
+    VT_SKIPPED = 26
   };
   int32_t id() const {
     return GetField<int32_t>(VT_ID, 0);
@@ -3353,6 +3361,24 @@ struct UnitDiff FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   bool mutate_flags(int64_t _flags) {
     return SetField<int64_t>(VT_FLAGS, _flags, 0);
   }
+  uint64_t var_mask() const {
+    return GetField<uint64_t>(VT_VAR_MASK, 0);
+  }
+  bool mutate_var_mask(uint64_t _var_mask) {
+    return SetField<uint64_t>(VT_VAR_MASK, _var_mask, 0);
+  }
+  const flatbuffers::Vector<uint8_t> *var_deltas() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_VAR_DELTAS);
+  }
+  flatbuffers::Vector<uint8_t> *mutable_var_deltas() {
+    return GetPointer<flatbuffers::Vector<uint8_t> *>(VT_VAR_DELTAS);
+  }
+  uint8_t skipped() const {
+    return GetField<uint8_t>(VT_SKIPPED, 0);
+  }
+  bool mutate_skipped(uint8_t _skipped) {
+    return SetField<uint8_t>(VT_SKIPPED, _skipped, 0);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int32_t>(verifier, VT_ID) &&
@@ -3368,6 +3394,10 @@ struct UnitDiff FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyField<double>(verifier, VT_VELOCITYX) &&
            VerifyField<double>(verifier, VT_VELOCITYY) &&
            VerifyField<int64_t>(verifier, VT_FLAGS) &&
+           VerifyField<uint64_t>(verifier, VT_VAR_MASK) &&
+           VerifyOffset(verifier, VT_VAR_DELTAS) &&
+           verifier.Verify(var_deltas()) &&
+           VerifyField<uint8_t>(verifier, VT_SKIPPED) &&
            verifier.EndTable();
   }
   UnitDiffT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
@@ -3405,6 +3435,15 @@ struct UnitDiffBuilder {
   void add_flags(int64_t flags) {
     fbb_.AddElement<int64_t>(UnitDiff::VT_FLAGS, flags, 0);
   }
+  void add_var_mask(uint64_t var_mask) {
+    fbb_.AddElement<uint64_t>(UnitDiff::VT_VAR_MASK, var_mask, 0);
+  }
+  void add_var_deltas(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> var_deltas) {
+    fbb_.AddOffset(UnitDiff::VT_VAR_DELTAS, var_deltas);
+  }
+  void add_skipped(uint8_t skipped) {
+    fbb_.AddElement<uint8_t>(UnitDiff::VT_SKIPPED, skipped, 0);
+  }
   explicit UnitDiffBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -3427,17 +3466,23 @@ inline flatbuffers::Offset<UnitDiff> CreateUnitDiff(
     int32_t order_size = 0,
     double velocityX = 0.0,
     double velocityY = 0.0,
-    int64_t flags = 0) {
+    int64_t flags = 0,
+    uint64_t var_mask = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> var_deltas = 0,
+    uint8_t skipped = 0) {
   UnitDiffBuilder builder_(_fbb);
+  builder_.add_var_mask(var_mask);
   builder_.add_flags(flags);
   builder_.add_velocityY(velocityY);
   builder_.add_velocityX(velocityX);
+  builder_.add_var_deltas(var_deltas);
   builder_.add_order_size(order_size);
   builder_.add_order_diffs(order_diffs);
   builder_.add_order_ids(order_ids);
   builder_.add_var_diffs(var_diffs);
   builder_.add_var_ids(var_ids);
   builder_.add_id(id);
+  builder_.add_skipped(skipped);
   return builder_.Finish();
 }
 
@@ -3451,7 +3496,10 @@ inline flatbuffers::Offset<UnitDiff> CreateUnitDiffDirect(
     int32_t order_size = 0,
     double velocityX = 0.0,
     double velocityY = 0.0,
-    int64_t flags = 0) {
+    int64_t flags = 0,
+    uint64_t var_mask = 0,
+    const std::vector<uint8_t> *var_deltas = nullptr,
+    uint8_t skipped = 0) {
   return torchcraft::fbs::CreateUnitDiff(
       _fbb,
       id,
@@ -3462,7 +3510,10 @@ inline flatbuffers::Offset<UnitDiff> CreateUnitDiffDirect(
       order_size,
       velocityX,
       velocityY,
-      flags);
+      flags,
+      var_mask,
+      var_deltas ? _fbb.CreateVector<uint8_t>(*var_deltas) : 0,
+      skipped);
 }
 
 flatbuffers::Offset<UnitDiff> CreateUnitDiff(flatbuffers::FlatBufferBuilder &_fbb, const UnitDiffT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
@@ -3470,6 +3521,7 @@ flatbuffers::Offset<UnitDiff> CreateUnitDiff(flatbuffers::FlatBufferBuilder &_fb
 struct UnitDiffContainerT : public flatbuffers::NativeTable {
   typedef UnitDiffContainer TableType;
   std::vector<std::unique_ptr<UnitDiffT>> units;
+  std::vector<int32_t> removed;
   UnitDiffContainerT() {
   }
 };
@@ -3477,7 +3529,8 @@ struct UnitDiffContainerT : public flatbuffers::NativeTable {
 struct UnitDiffContainer FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   typedef UnitDiffContainerT NativeTableType;
   enum {
-    VT_UNITS = 4
+    VT_UNITS = 4,
+    VT_REMOVED = 6
   };
   const flatbuffers::Vector<flatbuffers::Offset<UnitDiff>> *units() const {
     return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<UnitDiff>> *>(VT_UNITS);
@@ -3485,11 +3538,19 @@ struct UnitDiffContainer FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   flatbuffers::Vector<flatbuffers::Offset<UnitDiff>> *mutable_units() {
     return GetPointer<flatbuffers::Vector<flatbuffers::Offset<UnitDiff>> *>(VT_UNITS);
   }
+  const flatbuffers::Vector<int32_t> *removed() const {
+    return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_REMOVED);
+  }
+  flatbuffers::Vector<int32_t> *mutable_removed() {
+    return GetPointer<flatbuffers::Vector<int32_t> *>(VT_REMOVED);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_UNITS) &&
            verifier.Verify(units()) &&
            verifier.VerifyVectorOfTables(units()) &&
+           VerifyOffset(verifier, VT_REMOVED) &&
+           verifier.Verify(removed()) &&
            verifier.EndTable();
   }
   UnitDiffContainerT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
@@ -3503,6 +3564,9 @@ struct UnitDiffContainerBuilder {
   void add_units(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<UnitDiff>>> units) {
     fbb_.AddOffset(UnitDiffContainer::VT_UNITS, units);
   }
+  void add_removed(flatbuffers::Offset<flatbuffers::Vector<int32_t>> removed) {
+    fbb_.AddOffset(UnitDiffContainer::VT_REMOVED, removed);
+  }
   explicit UnitDiffContainerBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -3517,18 +3581,22 @@ struct UnitDiffContainerBuilder {
 
 inline flatbuffers::Offset<UnitDiffContainer> CreateUnitDiffContainer(
     flatbuffers::FlatBufferBuilder &_fbb,
-    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<UnitDiff>>> units = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<UnitDiff>>> units = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> removed = 0) {
   UnitDiffContainerBuilder builder_(_fbb);
+  builder_.add_removed(removed);
   builder_.add_units(units);
   return builder_.Finish();
 }
 
 inline flatbuffers::Offset<UnitDiffContainer> CreateUnitDiffContainerDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
-    const std::vector<flatbuffers::Offset<UnitDiff>> *units = nullptr) {
+    const std::vector<flatbuffers::Offset<UnitDiff>> *units = nullptr,
+    const std::vector<int32_t> *removed = nullptr) {
   return torchcraft::fbs::CreateUnitDiffContainer(
       _fbb,
-      units ? _fbb.CreateVector<flatbuffers::Offset<UnitDiff>>(*units) : 0);
+      units ? _fbb.CreateVector<flatbuffers::Offset<UnitDiff>>(*units) : 0,
+      removed ? _fbb.CreateVector<int32_t>(*removed) : 0);
 }
 
 flatbuffers::Offset<UnitDiffContainer> CreateUnitDiffContainer(flatbuffers::FlatBufferBuilder &_fbb, const UnitDiffContainerT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
@@ -3543,9 +3611,16 @@ struct FrameDiffT : public flatbuffers::NativeTable {
   std::vector<FrameDiffCreep> creep_map;
   int32_t reward;
   int32_t is_terminal;
+  std::vector<uint8_t> creep_runs;
+  std::vector<uint8_t> creep_values;
+  uint32_t prediction_frames;
+  std::vector<uint8_t> resource_deltas;
+  int32_t creep_size;
   FrameDiffT()
       : reward(0),
-        is_terminal(0) {
+        is_terminal(0),
+        prediction_frames(0),
+        creep_size(-1) {
   }
 };
 
@@ -3559,7 +3634,12 @@ struct FrameDiff FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_BULLETS = 12,
     VT_CREEP_MAP = 14,
     VT_REWARD = 16,
-    VT_IS_TERMINAL = 18
+    VT_IS_TERMINAL = 18,
+    VT_CREEP_RUNS = 20,
+    VT_CREEP_VALUES = 22,
+    VT_PREDICTION_FRAMES = 24,
+    VT_RESOURCE_DELTAS = 26,
+    VT_CREEP_SIZE = 28
   };
   const flatbuffers::Vector<int32_t> *pids() const {
     return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_PIDS);
@@ -3609,6 +3689,36 @@ struct FrameDiff FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   bool mutate_is_terminal(int32_t _is_terminal) {
     return SetField<int32_t>(VT_IS_TERMINAL, _is_terminal, 0);
   }
+  const flatbuffers::Vector<uint8_t> *creep_runs() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_CREEP_RUNS);
+  }
+  flatbuffers::Vector<uint8_t> *mutable_creep_runs() {
+    return GetPointer<flatbuffers::Vector<uint8_t> *>(VT_CREEP_RUNS);
+  }
+  const flatbuffers::Vector<uint8_t> *creep_values() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_CREEP_VALUES);
+  }
+  flatbuffers::Vector<uint8_t> *mutable_creep_values() {
+    return GetPointer<flatbuffers::Vector<uint8_t> *>(VT_CREEP_VALUES);
+  }
+  uint32_t prediction_frames() const {
+    return GetField<uint32_t>(VT_PREDICTION_FRAMES, 0);
+  }
+  bool mutate_prediction_frames(uint32_t _prediction_frames) {
+    return SetField<uint32_t>(VT_PREDICTION_FRAMES, _prediction_frames, 0);
+  }
+  const flatbuffers::Vector<uint8_t> *resource_deltas() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_RESOURCE_DELTAS);
+  }
+  flatbuffers::Vector<uint8_t> *mutable_resource_deltas() {
+    return GetPointer<flatbuffers::Vector<uint8_t> *>(VT_RESOURCE_DELTAS);
+  }
+  int32_t creep_size() const {
+    return GetField<int32_t>(VT_CREEP_SIZE, -1);
+  }
+  bool mutate_creep_size(int32_t _creep_size) {
+    return SetField<int32_t>(VT_CREEP_SIZE, _creep_size, -1);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_PIDS) &&
@@ -3628,6 +3738,14 @@ struct FrameDiff FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            verifier.Verify(creep_map()) &&
            VerifyField<int32_t>(verifier, VT_REWARD) &&
            VerifyField<int32_t>(verifier, VT_IS_TERMINAL) &&
+           VerifyOffset(verifier, VT_CREEP_RUNS) &&
+           verifier.Verify(creep_runs()) &&
+           VerifyOffset(verifier, VT_CREEP_VALUES) &&
+           verifier.Verify(creep_values()) &&
+           VerifyField<uint32_t>(verifier, VT_PREDICTION_FRAMES) &&
+           VerifyOffset(verifier, VT_RESOURCE_DELTAS) &&
+           verifier.Verify(resource_deltas()) &&
+           VerifyField<int32_t>(verifier, VT_CREEP_SIZE) &&
            verifier.EndTable();
   }
   FrameDiffT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
@@ -3662,6 +3780,21 @@ struct FrameDiffBuilder {
   void add_is_terminal(int32_t is_terminal) {
     fbb_.AddElement<int32_t>(FrameDiff::VT_IS_TERMINAL, is_terminal, 0);
   }
+  void add_creep_runs(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> creep_runs) {
+    fbb_.AddOffset(FrameDiff::VT_CREEP_RUNS, creep_runs);
+  }
+  void add_creep_values(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> creep_values) {
+    fbb_.AddOffset(FrameDiff::VT_CREEP_VALUES, creep_values);
+  }
+  void add_prediction_frames(uint32_t prediction_frames) {
+    fbb_.AddElement<uint32_t>(FrameDiff::VT_PREDICTION_FRAMES, prediction_frames, 0);
+  }
+  void add_resource_deltas(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> resource_deltas) {
+    fbb_.AddOffset(FrameDiff::VT_RESOURCE_DELTAS, resource_deltas);
+  }
+  void add_creep_size(int32_t creep_size) {
+    fbb_.AddElement<int32_t>(FrameDiff::VT_CREEP_SIZE, creep_size, -1);
+  }
   explicit FrameDiffBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -3683,8 +3816,18 @@ inline flatbuffers::Offset<FrameDiff> CreateFrameDiff(
     flatbuffers::Offset<flatbuffers::Vector<const Bullet *>> bullets = 0,
     flatbuffers::Offset<flatbuffers::Vector<const FrameDiffCreep *>> creep_map = 0,
     int32_t reward = 0,
-    int32_t is_terminal = 0) {
+    int32_t is_terminal = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> creep_runs = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> creep_values = 0,
+    uint32_t prediction_frames = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> resource_deltas = 0,
+    int32_t creep_size = -1) {
   FrameDiffBuilder builder_(_fbb);
+  builder_.add_creep_size(creep_size);
+  builder_.add_resource_deltas(resource_deltas);
+  builder_.add_prediction_frames(prediction_frames);
+  builder_.add_creep_values(creep_values);
+  builder_.add_creep_runs(creep_runs);
   builder_.add_is_terminal(is_terminal);
   builder_.add_reward(reward);
   builder_.add_creep_map(creep_map);
@@ -3705,7 +3848,12 @@ inline flatbuffers::Offset<FrameDiff> CreateFrameDiffDirect(
     const std::vector<const Bullet *> *bullets = nullptr,
     const std::vector<const FrameDiffCreep *> *creep_map = nullptr,
     int32_t reward = 0,
-    int32_t is_terminal = 0) {
+    int32_t is_terminal = 0,
+    const std::vector<uint8_t> *creep_runs = nullptr,
+    const std::vector<uint8_t> *creep_values = nullptr,
+    uint32_t prediction_frames = 0,
+    const std::vector<uint8_t> *resource_deltas = nullptr,
+    int32_t creep_size = -1) {
   return torchcraft::fbs::CreateFrameDiff(
       _fbb,
       pids ? _fbb.CreateVector<int32_t>(*pids) : 0,
@@ -3715,7 +3863,12 @@ inline flatbuffers::Offset<FrameDiff> CreateFrameDiffDirect(
       bullets ? _fbb.CreateVector<const Bullet *>(*bullets) : 0,
       creep_map ? _fbb.CreateVector<const FrameDiffCreep *>(*creep_map) : 0,
       reward,
-      is_terminal);
+      is_terminal,
+      creep_runs ? _fbb.CreateVector<uint8_t>(*creep_runs) : 0,
+      creep_values ? _fbb.CreateVector<uint8_t>(*creep_values) : 0,
+      prediction_frames,
+      resource_deltas ? _fbb.CreateVector<uint8_t>(*resource_deltas) : 0,
+      creep_size);
 }
 
 flatbuffers::Offset<FrameDiff> CreateFrameDiff(flatbuffers::FlatBufferBuilder &_fbb, const FrameDiffT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
@@ -4456,6 +4609,9 @@ inline void UnitDiff::UnPackTo(UnitDiffT *_o, const flatbuffers::resolver_functi
   { auto _e = velocityX(); _o->velocityX = _e; };
   { auto _e = velocityY(); _o->velocityY = _e; };
   { auto _e = flags(); _o->flags = _e; };
+  { auto _e = var_mask(); _o->var_mask = _e; };
+  { auto _e = var_deltas(); if (_e) { _o->var_deltas.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->var_deltas[_i] = _e->Get(_i); } } };
+  { auto _e = skipped(); _o->skipped = _e; };
 }
 
 inline flatbuffers::Offset<UnitDiff> UnitDiff::Pack(flatbuffers::FlatBufferBuilder &_fbb, const UnitDiffT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
@@ -4475,6 +4631,9 @@ inline flatbuffers::Offset<UnitDiff> CreateUnitDiff(flatbuffers::FlatBufferBuild
   auto _velocityX = _o->velocityX;
   auto _velocityY = _o->velocityY;
   auto _flags = _o->flags;
+  auto _var_mask = _o->var_mask;
+  auto _var_deltas = _o->var_deltas.size() ? _fbb.CreateVector(_o->var_deltas) : 0;
+  auto _skipped = _o->skipped;
   return torchcraft::fbs::CreateUnitDiff(
       _fbb,
       _id,
@@ -4485,7 +4644,10 @@ inline flatbuffers::Offset<UnitDiff> CreateUnitDiff(flatbuffers::FlatBufferBuild
       _order_size,
       _velocityX,
       _velocityY,
-      _flags);
+      _flags,
+      _var_mask,
+      _var_deltas,
+      _skipped);
 }
 
 inline UnitDiffContainerT *UnitDiffContainer::UnPack(const flatbuffers::resolver_function_t *_resolver) const {
@@ -4498,6 +4660,7 @@ inline void UnitDiffContainer::UnPackTo(UnitDiffContainerT *_o, const flatbuffer
   (void)_o;
   (void)_resolver;
   { auto _e = units(); if (_e) { _o->units.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->units[_i] = std::unique_ptr<UnitDiffT>(_e->Get(_i)->UnPack(_resolver)); } } };
+  { auto _e = removed(); if (_e) { _o->removed.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->removed[_i] = _e->Get(_i); } } };
 }
 
 inline flatbuffers::Offset<UnitDiffContainer> UnitDiffContainer::Pack(flatbuffers::FlatBufferBuilder &_fbb, const UnitDiffContainerT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
@@ -4509,9 +4672,11 @@ inline flatbuffers::Offset<UnitDiffContainer> CreateUnitDiffContainer(flatbuffer
   (void)_o;
   struct _VectorArgs { flatbuffers::FlatBufferBuilder *__fbb; const UnitDiffContainerT* __o; const flatbuffers::rehasher_function_t *__rehasher; } _va = { &_fbb, _o, _rehasher}; (void)_va;
   auto _units = _o->units.size() ? _fbb.CreateVector<flatbuffers::Offset<UnitDiff>> (_o->units.size(), [](size_t i, _VectorArgs *__va) { return CreateUnitDiff(*__va->__fbb, __va->__o->units[i].get(), __va->__rehasher); }, &_va ) : 0;
+  auto _removed = _o->removed.size() ? _fbb.CreateVector(_o->removed) : 0;
   return torchcraft::fbs::CreateUnitDiffContainer(
       _fbb,
-      _units);
+      _units,
+      _removed);
 }
 
 inline FrameDiffT *FrameDiff::UnPack(const flatbuffers::resolver_function_t *_resolver) const {
@@ -4531,6 +4696,11 @@ inline void FrameDiff::UnPackTo(FrameDiffT *_o, const flatbuffers::resolver_func
   { auto _e = creep_map(); if (_e) { _o->creep_map.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->creep_map[_i] = *_e->Get(_i); } } };
   { auto _e = reward(); _o->reward = _e; };
   { auto _e = is_terminal(); _o->is_terminal = _e; };
+  { auto _e = creep_runs(); if (_e) { _o->creep_runs.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->creep_runs[_i] = _e->Get(_i); } } };
+  { auto _e = creep_values(); if (_e) { _o->creep_values.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->creep_values[_i] = _e->Get(_i); } } };
+  { auto _e = prediction_frames(); _o->prediction_frames = _e; };
+  { auto _e = resource_deltas(); if (_e) { _o->resource_deltas.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->resource_deltas[_i] = _e->Get(_i); } } };
+  { auto _e = creep_size(); _o->creep_size = _e; };
 }
 
 inline flatbuffers::Offset<FrameDiff> FrameDiff::Pack(flatbuffers::FlatBufferBuilder &_fbb, const FrameDiffT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
@@ -4549,6 +4719,11 @@ inline flatbuffers::Offset<FrameDiff> CreateFrameDiff(flatbuffers::FlatBufferBui
   auto _creep_map = _o->creep_map.size() ? _fbb.CreateVectorOfStructs(_o->creep_map) : 0;
   auto _reward = _o->reward;
   auto _is_terminal = _o->is_terminal;
+  auto _creep_runs = _o->creep_runs.size() ? _fbb.CreateVector(_o->creep_runs) : 0;
+  auto _creep_values = _o->creep_values.size() ? _fbb.CreateVector(_o->creep_values) : 0;
+  auto _prediction_frames = _o->prediction_frames;
+  auto _resource_deltas = _o->resource_deltas.size() ? _fbb.CreateVector(_o->resource_deltas) : 0;
+  auto _creep_size = _o->creep_size;
   return torchcraft::fbs::CreateFrameDiff(
       _fbb,
       _pids,
@@ -4558,7 +4733,12 @@ inline flatbuffers::Offset<FrameDiff> CreateFrameDiff(flatbuffers::FlatBufferBui
       _bullets,
       _creep_map,
       _reward,
-      _is_terminal);
+      _is_terminal,
+      _creep_runs,
+      _creep_values,
+      _prediction_frames,
+      _resource_deltas,
+      _creep_size);
 }
 
 inline bool VerifyFrameOrFrameDiff(flatbuffers::Verifier &verifier, const void *obj, FrameOrFrameDiff type) {
@@ -32,6 +32,8 @@ public:
   std::string window_mode;
   std::string window_mode_custom;
   bool display_log;
+  int diff_threads;
+  int diff_min_units;
 private:
   std::string readString_(const char* section,
     const char* key,
@@ -159,7 +159,11 @@ class Controller {
   int combined_frames = 0;
   bool last_receive_ok = true;
   replayer::Frame* last_frame = nullptr;
+  // Frames are built from scratch every game frame and combined into
+  // last_frame right away, so they are recycled
+  replayer::FramePool frame_pool;
   replayer::Frame* prev_sent_frame = nullptr; // For frame diffs
+  replayer::FrameDiff sent_frame_diff; // Re-used to avoid allocations
   int battle_frame_count = 0;
   int frameskips = 1;
   bool exit_process_ = false;
@@ -20,6 +20,8 @@ ConfigManager::ConfigManager()
   // general
   port = 0;
   display_log = false;
+  diff_threads = 1;
+  diff_min_units = 1000;
   // starcraft
   assume_on = false;
 }
@@ -46,6 +48,8 @@ void ConfigManager::loadGeneralSection()
   window_mode = readString_("general", "window_mode", "windows");
   window_mode_custom = readString_("general", "window_mode_custom", "");
   img_save_path = readString_("general", "img_save_path", "C:/tc_data/output_");
+  diff_threads = readInt_("general", "diff_threads", 1);
+  diff_min_units = readInt_("general", "diff_min_units", 1000);
 }
 
 void ConfigManager::loadStarCraftSection()
@@ -126,6 +130,8 @@ std::string ConfigManager::toString() const
   data << "  window_mode = " << window_mode << std::endl;
   data << "  window_mode_custom = " << window_mode_custom << std::endl;
   data << "  img_save_path = " << img_save_path << std::endl;
+  data << "  diff_threads = " << diff_threads << std::endl;
+  data << "  diff_min_units = " << diff_min_units << std::endl;
   data << "starcraft" << std::endl;
   data << "  assume_on = " << assume_on << std::endl;
   data << "  launcher = " << launcher << std::endl;
@@ -43,6 +43,8 @@ Controller::Controller(bool is_client) {
   recorder_ = std::make_unique<Recorder>(config_->img_save_path);
 
   Utils::DISPLAY_LOG = config_->display_log;
+  replayer::setDiffThreads(
+      std::max(config_->diff_threads, 1), std::max(config_->diff_min_units, 0));
 
   std::cout << *config_ << std::endl;
 
@@ -597,9 +599,9 @@ FrameSerializationResults Controller::serializeFrameData(
     output.type = fbs::FrameOrFrameDiff::Frame;
     output.offset = last_frame->addToFlatBufferBuilder(builder).Union();
   } else {
-    auto frameDiff = replayer::frame_diff(last_frame, prev_sent_frame);
+    replayer::frame_diff(sent_frame_diff, last_frame, prev_sent_frame);
     output.type = fbs::FrameOrFrameDiff::FrameDiff;
-    output.offset = frameDiff.addToFlatBufferBuilder(builder).Union();
+    output.offset = sent_frame_diff.addToFlatBufferBuilder(builder).Union();
   }
   
   if (prev_sent_frame != nullptr) {
@@ -752,7 +754,7 @@ void Controller::onFrame() {
 
   // Save frame state
   if (!battle_ended || !this->sent_battle_end_frame || last_frame == nullptr) {
-    replayer::Frame* f = new replayer::Frame();
+    replayer::Frame* f = frame_pool.get();
     f->height = BWAPI::Broodwar->mapHeight() * 4;
     f->width = BWAPI::Broodwar->mapWidth() * 4;
 
@@ -772,12 +774,15 @@ void Controller::onFrame() {
     }
     this->packBullets(*f);
     this->packCreep(*f);
+    // Lets frame_diff() merge units without sorting them
+    f->sortUnits();
 
     // Combine with last_frame
     if (last_frame == nullptr) {
       last_frame = f;
     } else {
-      last_frame->combine(*f);
+      // f goes back to the frame pool afterwards, so its memory is taken over
+      last_frame->combine(std::move(*f));
       f->decref();
     }
     combined_frames++;
@@ -1123,7 +1128,8 @@ void Controller::addUnit(
   flags |= u->isUnderStorm() ? replayer::Unit::Flags::UnderStorm : 0;
   flags |= u->isUpgrading() ? replayer::Unit::Flags::Upgrading : 0;
 
-  frame.units[player->getID()].push_back({
+  auto& player_units = frame.playerUnits(player->getID());
+  player_units.push_back({
       u->getID(),
       x_wt,
       y_wt,
@@ -1151,7 +1157,8 @@ void Controller::addUnit(
       utype.airWeapon().damageType().getID(),
       player->weaponMaxRange(utype.groundWeapon()) / pixelsPerWalkTile,
       player->weaponMaxRange(utype.airWeapon()) / pixelsPerWalkTile,
-      std::vector<replayer::Order>(),
+      0, // orders_offset, see addOrder() below
+      0, // orders_size
       replayer::UnitCommand(),
       u->getVelocityX(),
       u->getVelocityY(),
@@ -1177,7 +1184,8 @@ void Controller::addUnit(
   }
   BWAPI::Position targetpos = u->getTargetPosition();
 
-  frame.units[player->getID()].back().orders.push_back(
+  frame.addOrder(
+      player_units.back(),
       {BWAPI::Broodwar->getFrameCount(), // first frame
        u->getOrder().getID(),
        targetid,
@@ -1185,7 +1193,7 @@ void Controller::addUnit(
        targetpos.isValid() ? targetpos.y / pixelsPerWalkTile : -1});
 
   if (u->getSecondaryOrder() != BWAPI::Orders::Nothing) {
-    frame.units[player->getID()].back().orders.push_back({
+    frame.addOrder(player_units.back(), {
         BWAPI::Broodwar->getFrameCount(),
         u->getSecondaryOrder().getID(),
         -1,
@@ -1195,7 +1203,7 @@ void Controller::addUnit(
   }
 
   // Set last command
-  auto& command = frame.units[player->getID()].back().command;
+  auto& command = player_units.back().command;
   auto lastCommand = u->getLastCommand();
   targetpos = lastCommand.getTargetPosition();
   command.frame = u->getLastCommandFrame();
@@ -55,9 +55,11 @@ State::State(const State& other)
       aliveUnits(other.aliveUnits),
       aliveUnitsConsidered(other.aliveUnitsConsidered),
       units(other.units),
+      orders(other.orders),
       numUpdates(other.numUpdates),
       microBattles_(other.microBattles_),
-      onlyConsiderTypes_(other.onlyConsiderTypes_) {}
+      onlyConsiderTypes_(other.onlyConsiderTypes_),
+      frameFields_(other.frameFields_) {}
 
 State::State(State&& other) : RefCounted(), frame(nullptr) {
   swap(*this, other);
@@ -110,9 +112,11 @@ void swap(State& a, State& b) {
   swap(a.aliveUnits, b.aliveUnits);
   swap(a.aliveUnitsConsidered, b.aliveUnitsConsidered);
   swap(a.units, b.units);
+  swap(a.orders, b.orders);
   swap(a.numUpdates, b.numUpdates);
   swap(a.microBattles_, b.microBattles_);
   swap(a.onlyConsiderTypes_, b.onlyConsiderTypes_);
+  swap(a.frameFields_, b.frameFields_);
 }
 
 void State::reset() {
@@ -145,6 +149,7 @@ void State::reset() {
   aliveUnits.clear();
   aliveUnitsConsidered.clear();
   units.clear();
+  orders.clear();
 
   numUpdates++;
 }
@@ -225,13 +230,13 @@ bool State::update_frame(const void* flatBuffer, const fbs::FrameOrFrameDiff typ
   switch (type) {
     case fbs::FrameOrFrameDiff::Frame: {
       auto frameFlatBuffer = static_cast<const fbs::Frame*>(flatBuffer);
-      frame->readFromFlatBufferTable(*frameFlatBuffer);
+      frame->readFromFlatBufferTable(*frameFlatBuffer, frameFields_);
       return true;
     }
     case fbs::FrameOrFrameDiff::FrameDiff:  {
       auto frameDiffFlatBuffer = static_cast<const fbs::FrameDiff*>(flatBuffer);
       replayer::FrameDiff frameDiff;
-      frameDiff.readFromFlatBufferTable(*frameDiffFlatBuffer);
+      frameDiff.readFromFlatBufferTable(*frameDiffFlatBuffer, frameFields_);
       replayer::frame_undiff(frame, frame, &frameDiff);
       return true;
     }
@@ -453,6 +458,20 @@ void State::postUpdate(std::vector<std::string>& upd) {
         });
   }
 
+  // Copy the orders of units so that they stay valid when the frame changes.
+  // Players that are not part of the frame keep their previous orders.
+  std::vector<Order> unitOrders;
+  for (auto& us : units) {
+    bool inFrame = frame->units.find(us.first) != frame->units.end();
+    for (auto& unit : us.second) {
+      auto uo = inFrame ? frame->unitOrders(unit) : this->unitOrders(unit);
+      unit.orders_offset = unitOrders.size();
+      unit.orders_size = uo.size();
+      unitOrders.insert(unitOrders.end(), uo.begin(), uo.end());
+    }
+  }
+  orders.swap(unitOrders);
+
   // Update alive units
   aliveUnits.clear();
   aliveUnitsConsidered.clear();
@@ -63,18 +63,20 @@ std::vector<tc::replayer::Unit> getMineralFields(tc::State* state) {
 
 // Check whether a unit's current orders include the given command
 bool isExecutingCommand(
+    const tc::State* state,
     const tc::replayer::Unit& unit,
     tc::BW::UnitCommandType command) {
   auto orders = tc::BW::commandToOrders(command);
+  auto unitOrders = state->unitOrders(unit);
   auto res = std::find_first_of(
-      unit.orders.begin(),
-      unit.orders.end(),
+      unitOrders.begin(),
+      unitOrders.end(),
       orders.begin(),
       orders.end(),
       [](const tc::replayer::Order& o1, tc::BW::Order o2) {
         return o1.type == o2;
       });
-  return res != unit.orders.end();
+  return res != unitOrders.end();
 }
 
 // Establish connection and perform initial handshake
@@ -196,9 +198,12 @@ void playGame(std::shared_ptr<tc::Client> cl, int* totalBattles) {
               });
           if (ccenter != myUnits.end()) {
             // Already executing build order?
-            if (!isExecutingCommand(unit, tc::BW::UnitCommandType::Build) &&
+            if (!isExecutingCommand(
+                    state, unit, tc::BW::UnitCommandType::Build) &&
                 !isExecutingCommand(
-                    unit, tc::BW::UnitCommandType::Right_Click_Position)) {
+                    state,
+                    unit,
+                    tc::BW::UnitCommandType::Right_Click_Position)) {
               actions.emplace_back(
                   tc::BW::Command::CommandUnit,
                   unit.id,
@@ -211,10 +216,14 @@ void playGame(std::shared_ptr<tc::Client> cl, int* totalBattles) {
           }
         } else {
           // Gather resources
-          if (!isExecutingCommand(unit, tc::BW::UnitCommandType::Gather) &&
-              !isExecutingCommand(unit, tc::BW::UnitCommandType::Build) &&
+          if (!isExecutingCommand(
+                  state, unit, tc::BW::UnitCommandType::Gather) &&
               !isExecutingCommand(
-                  unit, tc::BW::UnitCommandType::Right_Click_Position)) {
+                  state, unit, tc::BW::UnitCommandType::Build) &&
+              !isExecutingCommand(
+                  state,
+                  unit,
+                  tc::BW::UnitCommandType::Right_Click_Position)) {
             auto mineralFields = getMineralFields(state);
             auto target = getClosest(
                 unit.x, unit.y, mineralFields.begin(), mineralFields.end());
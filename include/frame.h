@@ -12,12 +12,16 @@
 #include <cassert>
 #include <cstdio>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
-#include "refcount.h"
 #include "messages_generated.h"
+#include "player_map.h"
+#include "refcount.h"
 
 #ifdef _MSC_VER
 typedef unsigned int uint32_t;
@@ -34,6 +38,7 @@ struct Bullet;
 struct Action;
 class Frame;
 class FrameDiff;
+class FramePool;
 namespace detail { class UnitDiff; }
 
 std::ostream& operator<<(std::ostream& out, const Frame& o);
@@ -91,7 +96,9 @@ struct Unit {
   int32_t groundDmgType, airDmgType;
   int32_t groundRange, airRange;
 
-  std::vector<Order> orders;
+  // The orders of a unit are stored in the order pool of its frame, see
+  // Frame::orders
+  uint32_t orders_offset, orders_size;
   UnitCommand command;
 
   double velocityX, velocityY;
@@ -163,6 +170,49 @@ struct Unit {
   };
 };
 
+// Units are plain data so that unit arrays can be copied and compared as a
+// whole
+static_assert(
+    std::is_trivially_copyable<Unit>::value,
+    "Unit must be trivially copyable");
+
+// The orders of a unit, see Frame::unitOrders()
+class OrderRange {
+ public:
+  OrderRange() : first_(nullptr), last_(nullptr) {}
+  // The range is empty if the orders of unit are not part of pool
+  OrderRange(const std::vector<Order>& pool, const Unit& unit)
+      : OrderRange() {
+    if (size_t(unit.orders_offset) + unit.orders_size <= pool.size()) {
+      first_ = pool.data() + unit.orders_offset;
+      last_ = first_ + unit.orders_size;
+    }
+  }
+
+  const Order* begin() const {
+    return first_;
+  }
+  const Order* end() const {
+    return last_;
+  }
+  size_t size() const {
+    return last_ - first_;
+  }
+  bool empty() const {
+    return first_ == last_;
+  }
+  const Order& operator[](size_t i) const {
+    return first_[i];
+  }
+  const Order& back() const {
+    return last_[-1];
+  }
+
+ private:
+  const Order* first_;
+  const Order* last_;
+};
+
 struct Resources {
   int32_t ore;
   int32_t gas;
@@ -303,17 +353,82 @@ struct Resources {
   // clang-format on
 };
 
+// Parts of frames that are decoded by readFromFlatBufferTable(), e.g.
+// FrameFields::UnitBasics | FrameFields::Resources for consumers that only
+// look at the basic attributes of units. Unit ids, the map size, reward and
+// is_terminal are always decoded; everything else that is not selected is
+// left at zero or empty. Diffs are projected the same way, so frames that
+// are rebuilt from projected keyframes and diffs hold the same values.
+struct FrameFields {
+  enum : uint32_t {
+    // playerId, type, x, y, health, max_health, shield, max_shield, flags
+    // and visible
+    UnitBasics = 1 << 0,
+    // All other unit fields except for orders and command. velocityX,
+    // velocityY, pixel_x and pixel_y are decoded with UnitBasics, too, since
+    // positions in predictive diffs depend on them (see frame_diff()).
+    UnitDetails = 1 << 1,
+    UnitOrders = 1 << 2,
+    UnitCommand = 1 << 3,
+    Actions = 1 << 4,
+    Resources = 1 << 5,
+    Bullets = 1 << 6,
+    Creep = 1 << 7,
+    All = (1 << 8) - 1,
+  };
+};
+
+// Recycles frames instead of freeing them: frames obtained from get() are
+// handed back to the pool once their last reference is dropped, and
+// subsequent calls to get() return them again. Recycled frames are empty,
+// but their containers keep their memory, so building and discarding a frame
+// for every game frame does not hit the allocator in steady state. The pool
+// is thread-safe and may be destroyed while some of its frames are still in
+// use; these are then freed as usual.
+class FramePool {
+ public:
+  explicit FramePool(size_t maxSize = 8);
+  ~FramePool();
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // Returns an empty frame with a reference count of 1
+  Frame* get();
+  // Number of frames that are ready to be re-used
+  size_t size() const;
+
+ private:
+  friend class Frame;
+  struct Shared {
+    std::mutex mutex;
+    std::vector<Frame*> frames;
+    size_t maxSize;
+    bool closed = false;
+    ~Shared();
+  };
+  static bool put(Shared& pool, Frame* f);
+
+  std::shared_ptr<Shared> shared_;
+};
+
 class Frame : public RefCounted {
  public:
-  // The keys of these hash tables are the players' ids.
-  std::unordered_map<int32_t, std::vector<Unit>> units;
-  std::unordered_map<int32_t, std::vector<Action>> actions;
-  std::unordered_map<int32_t, Resources> resources;
+  // The keys of these maps are the players' ids.
+  PlayerMap<std::vector<Unit>> units;
+  PlayerMap<std::vector<Action>> actions;
+  PlayerMap<Resources> resources;
+  // Orders of all units. Every unit refers to a contiguous range of them, see
+  // unitOrders(), addOrder() and setOrders().
+  std::vector<Order> orders;
   std::vector<Bullet> bullets;
   std::vector<uint8_t> creep_map; // Do not access directly
   uint32_t width, height;
   int reward;
   int is_terminal;
+  // Whether the units of every player are ordered by id, which lets diffing
+  // skip sorting them. Set by sortUnits() and by deserialization; code that
+  // modifies units directly needs to reset it.
+  bool units_sorted;
 
   Frame();
   Frame(Frame&& o);
@@ -323,12 +438,42 @@ class Frame : public RefCounted {
 
   void swap(Frame& a, Frame& b);
   void clear();
+  // Same as units[playerId], but new players re-use the memory of unit
+  // vectors of previous frames if this frame was obtained from a FramePool
+  std::vector<Unit>& playerUnits(int32_t playerId);
+  // Returns an empty range if the orders of unit are not part of this frame
+  OrderRange unitOrders(const Unit& unit) const {
+    return OrderRange(orders, unit);
+  }
+  // Appends an order to those of unit. If its orders are not at the end of
+  // the order pool, they are copied there first.
+  void addOrder(Unit& unit, const Order& order);
+  void setOrders(Unit& unit, const std::vector<Order>& unitOrders);
+  void sortUnits();
   void filter(int32_t x, int32_t y, Frame& o) const;
+  // Accumulates next_frame into this frame, for frame skipping: units take
+  // their state from next_frame and keep the orders of both frames, units
+  // that are not in next_frame stay. Units of the result are ordered by id.
   void combine(const Frame& next_frame);
+  // Same, but takes over the memory of next_frame rather than copying from
+  // it. next_frame is left in a valid but unspecified state.
+  void combine(Frame&& next_frame);
   bool getCreepAt(uint32_t x, uint32_t y);
   
   flatbuffers::Offset<fbs::Frame> addToFlatBufferBuilder(flatbuffers::FlatBufferBuilder& builder) const;
-  void readFromFlatBufferTable(const fbs::Frame& table);
+  void readFromFlatBufferTable(
+      const fbs::Frame& table,
+      uint32_t fields = FrameFields::All);
+
+ protected:
+  void release() override;
+
+ private:
+  friend class FramePool;
+  // Empty unit vectors of previous frames, see playerUnits()
+  std::vector<std::vector<Unit>> spare_units_;
+  // Set while the frame is in use if it was obtained from a FramePool
+  std::shared_ptr<FramePool::Shared> pool_;
 }; // class Frame
 
 // Frame diffs
@@ -337,22 +482,56 @@ class FrameDiff;
 namespace detail {
   class UnitDiff {
    public:
+    // Parts of a unit that are only set by a diff if they changed. Orders
+    // themselves are patched through order_ids and order_diffs either way.
+    enum Parts : uint8_t {
+      Velocity = 1 << 0, // velocityX and velocityY
+      Flags = 1 << 1,
+      OrderSize = 1 << 2,
+      AllParts = Velocity | Flags | OrderSize,
+    };
+
     int id;
-    std::vector<int32_t> var_ids;
+    // Bit k of var_mask is set if the unit field with id k changed (see
+    // frame_diff.cpp); var_diffs holds their deltas, ordered by field id.
+    uint64_t var_mask;
     std::vector<int32_t> var_diffs;
     std::vector<int32_t> order_ids;
     std::vector<int32_t> order_diffs;
     int32_t order_size;
     double velocityX, velocityY;
     int64_t flags;
+    // Bitmask of Parts that are set
+    uint8_t parts;
+  };
+
+  // Changes of the resources of a player since the base frame: deltas of
+  // the counters and the bits that flipped in the masks. Fields that did not
+  // change are zero and take no space once serialized.
+  struct ResourcesDiff {
+    int32_t ore;
+    int32_t gas;
+    int32_t used_psi;
+    int32_t total_psi;
+    uint64_t upgrades;
+    uint64_t upgrades_level;
+    uint64_t techs;
   };
 
   Frame* add(Frame* frame, FrameDiff* diff);
   void add(Frame* res, Frame* frame, FrameDiff* diff);
+  // Bits of UnitDiff::var_mask that belong to the given FrameFields
+  uint64_t unitVarMask(uint32_t fields);
 
   inline bool orderUnitByiD(const Unit& a, const Unit& b) {
     return (a.id < b.id);
   }
+  // Fills perm with the indices of units, ordered by unit id. If sorted is
+  // set, units are assumed to be ordered already.
+  void sortedIndices(
+      const std::vector<Unit>& units,
+      bool sorted,
+      std::vector<uint32_t>& perm);
 
   bool frameEq(Frame* f1, Frame* f2, bool debug = true);
 } // namespace detail
@@ -360,40 +539,81 @@ namespace detail {
 class FrameDiff {
  public:
   std::vector<int32_t> pids;
+  // Units that changed since the base frame, for each player in pids and
+  // ordered by id. Other units of the base frame are left as they are, except
+  // for those whose ids are in removed (also ordered by id).
   std::vector<std::vector<detail::UnitDiff>> units;
+  std::vector<std::vector<int32_t>> removed;
+  // Set for diffs written by older versions, which list all units of a
+  // player: units of the base frame that are not listed were removed.
+  bool all_units = false;
   // These are unlikely to be the same, so we just copy.
-  std::unordered_map<int32_t, std::vector<Action>> actions;
-  std::unordered_map<int32_t, Resources> resources;
+  PlayerMap<std::vector<Action>> actions;
+  // For each player of the frame; players of the base frame that are not
+  // listed are gone.
+  PlayerMap<detail::ResourcesDiff> resources;
+  // Set for diffs written by older versions, whose resources hold the
+  // resources of the frame rather than their changes
+  bool all_resources = false;
   std::vector<Bullet> bullets;
-  std::unordered_map<uint32_t, uint32_t> creep_map;
+  // Changed bytes of Frame::creep_map as (index, new value), by index
+  std::vector<std::pair<uint32_t, uint8_t>> creep_map;
+  // Size of Frame::creep_map, or -1 if unknown (written by older versions or
+  // not decoded), in which case the creep map of the base frame only grows
+  int32_t creep_size = -1;
   // Width and height never changes, so we don't diff them
   int reward;
   int is_terminal;
+  // If not 0, the deltas of x, y, pixel_x and pixel_y of units that are in
+  // both frames are relative to their position in the base frame moved by
+  // their velocity over this many game frames
+  uint32_t prediction_frames = 0;
+  // Parts that were decoded by readFromFlatBufferTable(), see FrameFields
+  uint32_t fields = FrameFields::All;
   
   flatbuffers::Offset<fbs::FrameDiff> addToFlatBufferBuilder(flatbuffers::FlatBufferBuilder& builder) const;
-  void readFromFlatBufferTable(const fbs::FrameDiff& fbsFrameDiff);
+  void readFromFlatBufferTable(
+      const fbs::FrameDiff& fbsFrameDiff,
+      uint32_t fields = FrameFields::All);
 };
 
 void writeTail(
     std::ostream& out,
-    const std::unordered_map<int32_t, std::vector<replayer::Action>>& actions,
-    const std::unordered_map<int32_t, replayer::Resources>& resources,
+    const PlayerMap<std::vector<replayer::Action>>& actions,
+    const PlayerMap<replayer::Resources>& resources,
     const std::vector<replayer::Bullet>& bullets);
 
 void readTail(
     std::istream& in,
-    std::unordered_map<int32_t, std::vector<replayer::Action>>& actions,
-    std::unordered_map<int32_t, replayer::Resources>& resources,
+    PlayerMap<std::vector<replayer::Action>>& actions,
+    PlayerMap<replayer::Resources>& resources,
     std::vector<replayer::Bullet>& bullets);
 
-// These diffing functions will order the IDs of units in each frame, and thus
-// is not const.
+// Units of the resulting diffs and frames are ordered by id. Frames with
+// units_sorted set are merged linearly; others are sorted on the fly (the
+// frames themselves are left untouched).
+// With predictive set, positions of units are predicted from their velocity
+// in the second frame, over the number of game frames that fits the motion
+// of all units best (see FrameDiff::prediction_frames). Units moving at a
+// steady pace then have deltas of zero, which compress better.
 FrameDiff frame_diff(Frame&, Frame&);
-FrameDiff frame_diff(Frame*, Frame*);
+FrameDiff frame_diff(Frame*, Frame*, bool predictive = false);
+// Same as above, but writes into an existing diff. Its buffers are re-used,
+// so diffing consecutive frames into the same FrameDiff does not allocate
+// memory in steady state.
+void frame_diff(FrameDiff& result, Frame*, Frame*, bool predictive = false);
 Frame* frame_undiff(FrameDiff*, Frame*);
 Frame* frame_undiff(Frame*, FrameDiff*);
 void frame_undiff(Frame* result, FrameDiff*, Frame*);
 void frame_undiff(Frame* result, Frame*, FrameDiff*);
 
+// Lets frame_diff() and frame_undiff() process the units of different players
+// on a pool of numThreads threads (including the calling one), for frames
+// with at least minUnits units in total; smaller frames are not worth the
+// synchronization. Results are the same as on a single thread. While the
+// pool is busy, other threads diff and undiff on their own. numThreads <= 1
+// turns this off again, which is the default.
+void setDiffThreads(size_t numThreads, size_t minUnits = 1000);
+
 } // namespace replayer
 } // namespace torchcraft
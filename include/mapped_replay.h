@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "messages_generated.h"
+
+namespace torchcraft {
+namespace replayer {
+
+/**
+ * Read-only, memory-mapped view of an uncompressed replay file.
+ *
+ * Unlike Replayer, this never materializes Frame objects: getFrameTable() and
+ * getFrameDiffTable() return pointers to the FlatBuffer tables inside the
+ * mapping, so scanning a replay only costs page faults. Keyframes are stored
+ * as fbs::Frame and all other frames as fbs::FrameDiff (see
+ * Replayer::getKeyFrame()). Note that a FrameDiff only lists the units that
+ * changed: units of the base frame that are not listed are unchanged unless
+ * they are in removed, and the parts of a unit in skipped are unchanged, too.
+ * Diffs written by older versions have no removed and list all units.
+ * FrameDiff::readFromFlatBufferTable() and frame_undiff() take care of this.
+ *
+ * Returned pointers are valid for the lifetime of the MappedReplay.
+ * Tables are not aligned within the file, which requires a platform that
+ * supports unaligned loads (x86, ARMv8).
+ */
+class MappedReplay {
+ public:
+  // If verify is true, tables are checked with a flatbuffers::Verifier
+  // before being handed out
+  explicit MappedReplay(const std::string& path, bool verify = true);
+  ~MappedReplay();
+  MappedReplay(const MappedReplay&) = delete;
+  MappedReplay& operator=(const MappedReplay&) = delete;
+
+  size_t size() const {
+    return frames_.size();
+  }
+  uint32_t getKeyFrame() const {
+    return keyframe_;
+  }
+  int32_t mapHeight() const {
+    return mapHeight_;
+  }
+  int32_t mapWidth() const {
+    return mapWidth_;
+  }
+  // Raw map data, see Replayer::getRawMap()
+  const uint8_t* getRawMap() const {
+    return mapData_;
+  }
+
+  bool isKeyFrame(size_t i) const {
+    return keyframe_ == 0 || i % keyframe_ == 0;
+  }
+  // Returns nullptr if i is out of range or not a keyframe
+  const fbs::Frame* getFrameTable(size_t i) const;
+  // Returns nullptr if i is out of range or a keyframe
+  const fbs::FrameDiff* getFrameDiffTable(size_t i) const;
+
+ private:
+  struct Span {
+    const uint8_t* data;
+    size_t size;
+  };
+
+  void map(const std::string& path);
+  void unmap();
+  void parse();
+
+  bool verify_;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#endif
+  uint32_t keyframe_ = 0;
+  int32_t mapHeight_ = 0;
+  int32_t mapWidth_ = 0;
+  const uint8_t* mapData_ = nullptr;
+  std::vector<Span> frames_;
+};
+
+} // namespace replayer
+} // namespace torchcraft
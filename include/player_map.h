@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+
+namespace torchcraft {
+namespace replayer {
+
+/*
+ * Map from player ids to T for the per-player data of frames.
+ *
+ * A game has at most 12 players, so entries are stored inline in a fixed
+ * array, in insertion order, and looked up by a linear scan over the ids.
+ * Copying a PlayerMap is a single copy of the array instead of a rebuild of
+ * hash buckets, and iteration walks contiguous memory. Player ids are
+ * arbitrary integers and are not used as indices.
+ *
+ * The interface is the subset of std::unordered_map used for Frame, so
+ * iterating with range-based for loops, find(), count(), at(), operator[],
+ * insert() and erase() work as before. Inserting elements does not invalidate
+ * references to other elements, but erasing one moves the elements after it.
+ */
+template <typename T>
+class PlayerMap {
+ public:
+  static const size_t kCapacity = 12;
+
+  typedef int32_t key_type;
+  typedef T mapped_type;
+  typedef std::pair<int32_t, T> value_type;
+  typedef size_t size_type;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+
+  PlayerMap() : size_(0) {}
+  PlayerMap(std::initializer_list<value_type> init) : size_(0) {
+    for (auto& v : init) {
+      insert(v);
+    }
+  }
+
+  iterator begin() {
+    return slots_.data();
+  }
+  iterator end() {
+    return slots_.data() + size_;
+  }
+  const_iterator begin() const {
+    return slots_.data();
+  }
+  const_iterator end() const {
+    return slots_.data() + size_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  iterator find(int32_t key) {
+    for (size_t i = 0; i < size_; i++) {
+      if (slots_[i].first == key)
+        return begin() + i;
+    }
+    return end();
+  }
+  const_iterator find(int32_t key) const {
+    for (size_t i = 0; i < size_; i++) {
+      if (slots_[i].first == key)
+        return begin() + i;
+    }
+    return end();
+  }
+  size_t count(int32_t key) const {
+    return find(key) == end() ? 0 : 1;
+  }
+
+  T& at(int32_t key) {
+    auto it = find(key);
+    if (it == end())
+      throw std::out_of_range("PlayerMap::at: unknown player");
+    return it->second;
+  }
+  const T& at(int32_t key) const {
+    auto it = find(key);
+    if (it == end())
+      throw std::out_of_range("PlayerMap::at: unknown player");
+    return it->second;
+  }
+
+  T& operator[](int32_t key) {
+    auto it = find(key);
+    if (it != end())
+      return it->second;
+    return append(key)->second;
+  }
+
+  std::pair<iterator, bool> insert(const value_type& v) {
+    auto it = find(v.first);
+    if (it != end())
+      return std::make_pair(it, false);
+    it = append(v.first);
+    it->second = v.second;
+    return std::make_pair(it, true);
+  }
+  // For std::inserter(); the hint is ignored
+  iterator insert(const_iterator, const value_type& v) {
+    return insert(v).first;
+  }
+  template <typename V>
+  std::pair<iterator, bool> emplace(int32_t key, V&& value) {
+    auto it = find(key);
+    if (it != end())
+      return std::make_pair(it, false);
+    it = append(key);
+    it->second = std::forward<V>(value);
+    return std::make_pair(it, true);
+  }
+
+  iterator erase(const_iterator pos) {
+    auto it = begin() + (pos - begin());
+    for (auto next = it + 1; next != end(); ++next) {
+      *(next - 1) = std::move(*next);
+    }
+    slots_[--size_] = value_type();
+    return it;
+  }
+  size_t erase(int32_t key) {
+    auto it = find(key);
+    if (it == end())
+      return 0;
+    erase(it);
+    return 1;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < size_; i++) {
+      slots_[i] = value_type();
+    }
+    size_ = 0;
+  }
+
+  void swap(PlayerMap& o) {
+    std::swap(slots_, o.slots_);
+    std::swap(size_, o.size_);
+  }
+  friend void swap(PlayerMap& a, PlayerMap& b) {
+    a.swap(b);
+  }
+
+  // Same as for std::unordered_map, the order of elements does not matter
+  bool operator==(const PlayerMap& o) const {
+    if (size_ != o.size_)
+      return false;
+    for (auto& v : *this) {
+      auto it = o.find(v.first);
+      if (it == o.end() || !(it->second == v.second))
+        return false;
+    }
+    return true;
+  }
+  bool operator!=(const PlayerMap& o) const {
+    return !(*this == o);
+  }
+
+ private:
+  iterator append(int32_t key) {
+    if (size_ == kCapacity)
+      throw std::runtime_error("Too many players");
+    slots_[size_].first = key;
+    return begin() + size_++;
+  }
+
+  // Slots past size_ hold default-constructed values
+  std::array<value_type, kCapacity> slots_;
+  size_t size_;
+};
+
+template <typename T>
+const size_t PlayerMap<T>::kCapacity;
+
+} // namespace replayer
+} // namespace torchcraft
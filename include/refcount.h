@@ -36,6 +36,13 @@ class RefCounted {
   }
   void decref() {
     if (--refs == 0)
-      delete this;
+      release();
+  }
+
+ protected:
+  // Called once the last reference is dropped. Objects that are recycled
+  // rather than freed (see replayer::FramePool) override this.
+  virtual void release() {
+    delete this;
   }
 };
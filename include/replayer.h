@@ -9,9 +9,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "frame.h"
@@ -21,11 +25,39 @@
 namespace torchcraft {
 namespace replayer {
 
+struct ReplayHeader;
+
 struct Map {
   uint32_t height, width;
   std::vector<uint8_t> data;
 };
 
+// Units of a whole replay, flattened into one array per field (struct of
+// arrays). The units of frame i are at indices
+// [frameOffsets[i], frameOffsets[i + 1]), ordered by player id; units of a
+// player keep the order of Frame::units.
+struct UnitColumns {
+  std::vector<uint64_t> frameOffsets;
+  std::vector<int32_t> frame;
+  std::vector<int32_t> playerId;
+  std::vector<int32_t> id;
+  std::vector<int32_t> type;
+  std::vector<int32_t> x, y;
+  std::vector<int32_t> pixel_x, pixel_y;
+  std::vector<int32_t> health, max_health, shield, max_shield, energy;
+  std::vector<int32_t> groundCD, airCD;
+  std::vector<int32_t> visible;
+  std::vector<int32_t> resources;
+  std::vector<uint64_t> flags;
+  std::vector<double> velocityX, velocityY;
+
+  size_t size() const {
+    return id.size();
+  }
+  void reserve(size_t n);
+  void push(int32_t frame, const Unit& u);
+};
+
 class Replayer : public RefCounted {
  private:
   std::vector<Frame*> frames;
@@ -33,10 +65,56 @@ class Replayer : public RefCounted {
   Map map;
   // If keyframe = 0, every frame is a frame.
   // Otherwise, every keyframe is a frame, and all others are diffs.
-  // Only affects saving/loading (replays are still large in memory)
+  // Only affects saving/loading unless compact() is called.
   uint32_t keyframe;
+  // Parts of frames that are decoded when loading, see FrameFields
+  uint32_t fields = FrameFields::All;
+  // Whether save() writes predictive diffs, see frame_diff()
+  bool predictive = false;
+
+  // Compact mode, see compact(). Only keyframes are kept as frames; the
+  // others are stored as diffs to their predecessor and rebuilt on access.
+  // Rebuilt frames share the LRU cache of lazy mode.
+  std::vector<std::unique_ptr<FrameDiff>> diffs;
+  uint32_t diffKeyframe = 0;
+
+  // Lazy loading, see load(). Frames that have not been decoded yet are
+  // nullptr in `frames`. Decoded frames are kept in an LRU list and released
+  // once more than `cacheSize` of them are resident.
+  std::unique_ptr<std::istream> source;
+  std::vector<uint64_t> segmentOffsets; // Byte offset of each keyframe
+  uint32_t sourceKeyframe;
+  size_t numSourceFrames;
+  size_t cacheSize = 256;
+  std::list<size_t> lru;
+  std::unordered_map<size_t, std::list<size_t>::iterator> lruPos;
+  // Evicted frames are recycled for decoding the next ones
+  FramePool framePool;
+
+  void readHeader(std::istream& in, ReplayHeader& header);
+  void readFrames(
+      std::istream& in,
+      size_t nFrames,
+      size_t numThreads,
+      bool terminated = false);
+  void
+  readFramesConcurrently(std::istream& in, size_t nFrames, size_t numThreads);
+  bool readChunks(
+      std::istream& raw,
+      const std::vector<std::pair<uint64_t, uint64_t>>& chunks,
+      const std::vector<uint64_t>& offsets,
+      uint64_t tailOffset,
+      size_t nFrames,
+      size_t numThreads);
+  void decodeFrames(std::istream& in, size_t begin, size_t end);
+  void readNumUnits(std::istream& in, const ReplayHeader& header);
+  void loadLazy(std::unique_ptr<std::istream> in);
+  void readSegment(size_t i);
+  void rebuildFrame(size_t i);
+  void touchFrame(size_t i);
 
  public:
+  Replayer() : keyframe(0) {}
   ~Replayer() {
     for (auto f : frames) {
       if (f)
@@ -44,15 +122,17 @@ class Replayer : public RefCounted {
     }
   }
 
+  // In lazy or compact mode, the returned frame is only guaranteed to stay
+  // alive until the next call to getFrame(); incref() it to keep it around
+  // for longer.
   Frame* getFrame(size_t i) {
     if (i >= frames.size())
       return nullptr;
+    if ((source && i < numSourceFrames) || (i < diffs.size() && diffs[i]))
+      touchFrame(i);
     return frames[i];
   }
-  void push(Frame* f) {
-    auto new_frame = new Frame(f);
-    frames.push_back(new_frame);
-  }
+  void push(Frame* f);
   void setKeyFrame(int32_t x) {
     keyframe = x < 0 ? frames.size() + 1 : (uint32_t)x;
   }
@@ -70,7 +150,10 @@ class Replayer : public RefCounted {
   }
 
   void setNumUnits() {
-    for (const auto f : frames) {
+    for (size_t j = 0; j < frames.size(); j++) {
+      auto f = isCompact() ? getFrame(j) : frames[j];
+      if (f == nullptr) // Not decoded yet in lazy mode
+        continue;
       for (auto u : f->units) {
         auto s = u.second.size();
         auto i = u.first;
@@ -89,6 +172,9 @@ class Replayer : public RefCounted {
     return numUnits.at(key);
   }
 
+  // Flattens the units of all frames, see UnitColumns
+  UnitColumns getUnitColumns();
+
   void setMapFromState(torchcraft::State const* state);
 
   void setMap(
@@ -131,8 +217,177 @@ class Replayer : public RefCounted {
   friend std::ostream& operator<<(std::ostream& out, const Replayer& o);
   friend std::istream& operator>>(std::istream& in, Replayer& o);
 
-  void load(const std::string& path);
+  // With lazy = true, only the header and the keyframe index are read;
+  // frames are decoded on demand by getFrame(), seeking to the closest
+  // keyframe. This also works for compressed replays written by save(),
+  // which are split into independently compressed chunks of whole keyframe
+  // segments; compressed replays from older versions are always loaded
+  // eagerly.
+  // When loading eagerly, keyframe segments (or chunks) are decoded
+  // concurrently on numThreads threads.
+  void load(
+      const std::string& path,
+      bool lazy = false,
+      size_t numThreads = 1);
   void save(const std::string& path, bool compressed = false);
+
+  // Restricts the parts of frames that are decoded by subsequent calls to
+  // load() and, in lazy mode, getFrame(). See FrameFields.
+  void setFields(uint32_t f) {
+    fields = f;
+  }
+  uint32_t getFields() const {
+    return fields;
+  }
+
+  // Makes save() predict the positions of units from their velocities in
+  // diffs, see frame_diff(). Diffs of compact replays are written as they are.
+  void setPredictive(bool p) {
+    predictive = p;
+  }
+  bool isPredictive() const {
+    return predictive;
+  }
+
+  bool isLazy() const {
+    return source != nullptr;
+  }
+  // Switches to a compact in-memory representation: frames in between
+  // keyframes are replaced by diffs and rebuilt by getFrame() on demand,
+  // which reduces memory usage by up to a factor of getKeyFrame(). This is
+  // not supported in lazy mode.
+  void compact();
+  bool isCompact() const {
+    return diffKeyframe != 0;
+  }
+  // Maximum number of decoded frames kept in memory in lazy or compact mode
+  void setCacheSize(size_t n) {
+    cacheSize = std::max(n, size_t(1));
+  }
+};
+
+// Writes a replay to disk while frames are being recorded, as opposed to
+// Replayer::save() which requires the whole game to be held in memory.
+// Keyframes and diffs are appended as frames are pushed; only the previous
+// frame is kept around for diffing. The frame count and the numUnits table
+// (see Replayer::setNumUnits()) are written in a footer by close(). The
+// resulting files can be read with Replayer::load().
+class ReplayWriter {
+ public:
+  // See Replayer::setKeyFrame() for the meaning of keyframe
+  explicit ReplayWriter(
+      const std::string& path,
+      uint32_t keyframe = 0,
+      bool compressed = false);
+  ~ReplayWriter();
+  ReplayWriter(const ReplayWriter&) = delete;
+  ReplayWriter& operator=(const ReplayWriter&) = delete;
+
+  // The map is written along with the first frame and can't be changed
+  // afterwards
+  void setMapFromState(torchcraft::State const* state);
+  void setRawMap(uint32_t h, uint32_t w, uint8_t const* d);
+
+  void push(Frame* f);
+  // Writes the footer. Called by the destructor if needed.
+  void close();
+
+  // Makes subsequent diffs predict the positions of units from their
+  // velocities, see frame_diff()
+  void setPredictive(bool p) {
+    predictive_ = p;
+  }
+
+  size_t size() const {
+    return numFrames_;
+  }
+  bool isOpen() const {
+    return out_ != nullptr;
+  }
+
+ private:
+  void writeHeader();
+  void write(const std::string& data);
+
+  std::unique_ptr<std::ostream> out_;
+  uint32_t keyframe_;
+  Map map_;
+  bool headerWritten_ = false;
+  bool predictive_ = false;
+  Frame prev_;
+  FrameDiff diff_;
+  size_t numFrames_ = 0;
+  size_t lastFlush_ = 0;
+  uint64_t pos_ = 0;
+  std::vector<uint64_t> offsets_;
+  std::unordered_map<int32_t, int32_t> numUnits_;
+};
+
+// Reads a replay file front to back, one frame at a time, in any of the
+// formats supported by Replayer::load(). A single Frame is re-used: keyframes
+// are decoded into it and diffs are applied to it in place, so memory usage
+// does not depend on the length of the replay.
+class ReplayReader {
+ public:
+  // Only the given FrameFields of frames are decoded
+  explicit ReplayReader(
+      const std::string& path,
+      uint32_t fields = FrameFields::All);
+  ~ReplayReader();
+  ReplayReader(const ReplayReader&) = delete;
+  ReplayReader& operator=(const ReplayReader&) = delete;
+
+  // Decodes the next frame, or returns nullptr at the end of the replay. The
+  // returned frame is owned by the reader and overwritten by the next call.
+  Frame* next();
+  // Number of frames returned by next() so far
+  size_t position() const {
+    return position_;
+  }
+
+  // The frame count and the numUnits table are stored at the end of replays.
+  // For compressed replays written before save() produced seekable files,
+  // they are only available once next() returned nullptr; until then, size()
+  // returns 0 for replays written by ReplayWriter and getNumUnits() returns
+  // -1.
+  size_t size() const {
+    return nFrames_ == size_t(-1) ? 0 : nFrames_;
+  }
+  int32_t getNumUnits(const int32_t& key) const {
+    auto it = numUnits_.find(key);
+    return it == numUnits_.end() ? -1 : it->second;
+  }
+
+  uint32_t getKeyFrame() const {
+    return keyframe_;
+  }
+  int32_t mapHeight() const {
+    return map_.height;
+  }
+  int32_t mapWidth() const {
+    return map_.width;
+  }
+  const std::vector<uint8_t>& getRawMap() const {
+    return map_.data;
+  }
+
+ private:
+  void readTail();
+
+  std::unique_ptr<std::istream> in_;
+  std::unique_ptr<ReplayHeader> header_;
+  uint32_t fields_;
+  uint32_t keyframe_;
+  Map map_;
+  size_t nFrames_;
+  bool streamed_;
+  std::unordered_map<int32_t, int32_t> numUnits_;
+  bool tailRead_ = false;
+  bool done_ = false;
+  size_t position_ = 0;
+  std::vector<char> buffer_;
+  Frame frame_;
+  FrameDiff diff_;
 };
 
 } // namespace replayer
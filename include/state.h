@@ -113,6 +113,8 @@ class State : public RefCounted {
   // - In micro mode and with frame skipping, deaths are only applied until the
   //   battle is considered finished, i.e. it corresponds to aliveUnits.
   std::unordered_map<int32_t, std::vector<Unit>> units;
+  // Orders of the units above, see unitOrders() and replayer::Frame::orders
+  std::vector<Order> orders;
 
   // Total number of updates received since creation (resets are counted as
   // well).
@@ -140,6 +142,21 @@ class State : public RefCounted {
     onlyConsiderTypes_ = std::move(types);
     aliveUnitsConsidered.clear();
   }
+  // Parts of frames that are decoded from updates (see
+  // replayer::FrameFields). Unit types and player ids are needed to track
+  // alive units, so UnitBasics should always be included. Takes effect with
+  // the next full frame sent by the server.
+  uint32_t frameFields() const {
+    return frameFields_;
+  }
+  void setFrameFields(uint32_t fields) {
+    frameFields_ = fields;
+  }
+
+  // Orders of a unit in `units`
+  replayer::OrderRange unitOrders(const Unit& unit) const {
+    return replayer::OrderRange(orders, unit);
+  }
 
   void reset();
   std::vector<std::string> update(const fbs::HandshakeServer* handshake);
@@ -185,6 +202,7 @@ class State : public RefCounted {
 
   bool microBattles_;
   std::set<BW::UnitType> onlyConsiderTypes_;
+  uint32_t frameFields_ = replayer::FrameFields::All;
 };
 
 } // namespace torchcraft
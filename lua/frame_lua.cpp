@@ -437,21 +437,22 @@ void toFrame(lua_State* L, int id, Frame& res) {
       lua_pushnil(L);
       while (lua_next(L, -2) != 0) {
         luaL_checktype(L, -2, LUA_TNUMBER);
-        unit.orders.push_back(Order());
+        Order order;
 
-        unit.orders.back().first_frame = getInt(L, "first_frame");
-        unit.orders.back().type = getInt(L, "type");
-        unit.orders.back().targetId = getInt(L, "target");
+        order.first_frame = getInt(L, "first_frame");
+        order.type = getInt(L, "type");
+        order.targetId = getInt(L, "target");
 
         getField(L, "targetpos");
         lua_rawgeti(L, -1, 1);
-        unit.orders.back().targetX = lua_tonumber(L, -1);
+        order.targetX = lua_tonumber(L, -1);
         lua_pop(L, 1);
         lua_rawgeti(L, -1, 2);
-        unit.orders.back().targetY = lua_tonumber(L, -1);
+        order.targetY = lua_tonumber(L, -1);
         lua_pop(L, 1);
         lua_pop(L, 1);
 
+        res.addOrder(unit, order);
         lua_pop(L, 1);
       }
       lua_pop(L, 1); // pop orders
@@ -531,7 +532,7 @@ void pushResources(lua_State* L, const Resources& resources) {
   setFlags(L, "techs", resources.techs, techName);
 }
 
-void pushUnit(lua_State* L, const Unit& unit) {
+void pushUnit(lua_State* L, const Unit& unit, const OrderRange& orders) {
   lua_newtable(L);
   // position
   lua_pushstring(L, "position");
@@ -574,17 +575,17 @@ void pushUnit(lua_State* L, const Unit& unit) {
   // orders
   lua_pushstring(L, "orders");
   lua_newtable(L);
-  for (unsigned i = 0; i < unit.orders.size(); i++) {
+  for (unsigned i = 0; i < orders.size(); i++) {
     lua_newtable(L);
-    setInt(L, "first_frame", unit.orders[i].first_frame);
-    setInt(L, "type", unit.orders[i].type);
-    setInt(L, "target", unit.orders[i].targetId);
+    setInt(L, "first_frame", orders[i].first_frame);
+    setInt(L, "type", orders[i].type);
+    setInt(L, "target", orders[i].targetId);
 
     lua_pushstring(L, "targetpos");
     lua_newtable(L);
-    lua_pushnumber(L, (lua_Number)unit.orders[i].targetX);
+    lua_pushnumber(L, (lua_Number)orders[i].targetX);
     lua_rawseti(L, -2, 1);
-    lua_pushnumber(L, (lua_Number)unit.orders[i].targetY);
+    lua_pushnumber(L, (lua_Number)orders[i].targetY);
     lua_rawseti(L, -2, 2);
     lua_settable(L, -3);
 
@@ -616,8 +617,8 @@ void pushUnit(lua_State* L, const Unit& unit) {
              -1,
              -1,
              -1};
-  if (!unit.orders.empty())
-    o = unit.orders.back();
+  if (!orders.empty())
+    o = orders.back();
 
   setInt(L, "order", o.type);
   setInt(L, "target", o.targetId);
@@ -682,7 +683,7 @@ void pushFrame(lua_State* L, const Frame& res) {
   for (const auto& player : res.units) {
     lua_newtable(L);
     for (const auto& unit : player.second) {
-      pushUnit(L, unit);
+      pushUnit(L, unit, res.unitOrders(unit));
       lua_rawseti(L, -2, unit.id);
     }
     lua_rawseti(L, -2, player.first);
@@ -714,7 +715,7 @@ extern "C" int frameGetUnits(lua_State* L) {
 
   for (const auto& unit : f->units.at(playerId)) {
     lua_pushnumber(L, (lua_Number)unit.id);
-    pushUnit(L, unit);
+    pushUnit(L, unit, f->unitOrders(unit));
     lua_settable(L, -3);
   }
 
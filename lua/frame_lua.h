@@ -43,7 +43,10 @@ void setBool(lua_State* L, const char* key, bool v);
 bool getField(lua_State* L, const char* key);
 int getInt(lua_State* L, const char* key);
 bool getBool(lua_State* L, const char* key);
-void pushUnit(lua_State* L, const torchcraft::replayer::Unit& unit);
+void pushUnit(
+    lua_State* L,
+    const torchcraft::replayer::Unit& unit,
+    const torchcraft::replayer::OrderRange& orders);
 
 // Lua tables from/to Frame class
 void toFrame(lua_State* L, int id, torchcraft::replayer::Frame& res);
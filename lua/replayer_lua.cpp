@@ -41,6 +41,21 @@ extern "C" int gcReplayer(lua_State* L) {
 
 extern "C" int loadReplayer(lua_State* L) {
   auto path = luaL_checkstring(L, 1);
+  if (lua_gettop(L) > 1 && lua_toboolean(L, 2)) {
+    Replayer* rep = new Replayer();
+    try {
+      rep->load(path, true);
+    } catch (std::exception& e) {
+      rep->decref();
+      luaL_error(L, "C++ exception in loadReplayer: %s", e.what());
+    }
+    Replayer** r = (Replayer**)lua_newuserdata(L, sizeof(Replayer*));
+    *r = rep;
+    luaL_getmetatable(L, "torchcraft.Replayer");
+    lua_setmetatable(L, -2);
+    return 1;
+  }
+
 #ifdef WITH_ZSTD
   // zstd::ifstream will auto-detect compressed data
   zstd::ifstream in(path);
@@ -88,7 +103,7 @@ extern "C" int replayerSave(lua_State* L) {
 
   if (compressed) {
 #ifdef WITH_ZSTD
-    zstd::ofstream out(path);
+    zstd::ofstream out(path, std::ios::out, true);
     luaL_argcheck(L, out, 2, "invalid save path");
     out << *r;
     out.close();
@@ -133,6 +148,16 @@ extern "C" int replayerGetKeyFrame(lua_State* L) {
   return 1;
 }
 
+extern "C" int replayerCompact(lua_State* L) {
+  auto r = checkReplayer(L);
+  try {
+    r->compact();
+  } catch (std::exception& e) {
+    return luaL_error(L, "C++ exception in compact: %s", e.what());
+  }
+  return 0;
+}
+
 extern "C" int replayerGetNumUnits(lua_State* L) {
   auto r = checkReplayer(L);
   auto id = luaL_checkint(L, 2);
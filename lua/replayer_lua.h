@@ -35,6 +35,7 @@ extern "C" int replayerGetNumUnits(lua_State* L);
 extern "C" int replayerSetNumUnits(lua_State* L);
 extern "C" int replayerGetKeyFrame(lua_State* L);
 extern "C" int replayerSetKeyFrame(lua_State* L);
+extern "C" int replayerCompact(lua_State* L);
 
 // const struct luaL_Reg replayer_m [] = {
 const struct luaL_Reg replayer_m[] = {{"__gc", gcReplayer},
@@ -48,4 +49,5 @@ const struct luaL_Reg replayer_m[] = {{"__gc", gcReplayer},
                                       {"setMap", replayerSetMap},
                                       {"getMap", replayerGetMap},
                                       {"push", replayerPush},
+                                      {"compact", replayerCompact},
                                       {nullptr, nullptr}};
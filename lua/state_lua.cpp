@@ -236,10 +236,13 @@ void pushFrameMember(
   lua_call(L, 2, 1);
 }
 
-void pushUnits(lua_State* L, const std::vector<torchcraft::Unit>& units) {
+void pushUnits(
+    lua_State* L,
+    const torchcraft::State* s,
+    const std::vector<torchcraft::Unit>& units) {
   lua_createtable(L, units.size(), 0);
   for (const auto& u : units) {
-    pushUnit(L, u);
+    pushUnit(L, u, s->unitOrders(u));
     lua_rawseti(L, -2, u.id);
   }
 }
@@ -264,9 +267,9 @@ void updateUserValueAndPush(
   // Update
   auto myself = s->player_id;
   if (!s->replay) {
-    pushUnits(L, s->units[myself]);
+    pushUnits(L, s, s->units[myself]);
     lua_setfield(L, -2, "units_myself");
-    pushUnits(L, s->units[1 - myself]);
+    pushUnits(L, s, s->units[1 - myself]);
     lua_setfield(L, -2, "units_enemy");
     pushFrameMember(L, s, frameGetResources, myself);
     lua_setfield(L, -2, "resources_myself");
@@ -275,7 +278,7 @@ void updateUserValueAndPush(
     lua_newtable(L);
     for (size_t p = 0; p < nplayers; p++) {
       if ((long) p != (long) s->neutral_id) {
-        pushUnits(L, s->units[p]);
+        pushUnits(L, s, s->units[p]);
         lua_rawseti(L, -2, p);
       }
     }
@@ -291,7 +294,7 @@ void updateUserValueAndPush(
     lua_setfield(L, -2, "resources");
   }
 
-  pushUnits(L, s->units[s->neutral_id]);
+  pushUnits(L, s, s->units[s->neutral_id]);
   lua_setfield(L, -2, "units_neutral");
 
   lua_pushinteger(L, s->numUpdates);
@@ -7,6 +7,19 @@
 #include <pybind11/operators.h>
 using namespace torchcraft::replayer;
 
+namespace {
+
+// Hands the vector's buffer over to NumPy without copying it
+template <typename T>
+py::array_t<T> toArray(std::vector<T>&& v) {
+  auto data = new std::vector<T>(std::move(v));
+  py::capsule owner(
+      data, [](void* p) { delete static_cast<std::vector<T>*>(p); });
+  return py::array_t<T>(data->size(), data->data(), owner);
+}
+
+} // namespace
+
 void init_replayer(py::module& m) {
   py::module m_sub = m.def_submodule("replayer");
   py::class_<Order>(m_sub, "Order")
@@ -57,7 +70,8 @@ void init_replayer(py::module& m) {
       .def_readwrite("airDmgType", &Unit::airDmgType)
       .def_readwrite("groundRange", &Unit::groundRange)
       .def_readwrite("airRange", &Unit::airRange)
-      .def_readwrite("orders", &Unit::orders)
+      .def_readwrite("orders_offset", &Unit::orders_offset)
+      .def_readwrite("orders_size", &Unit::orders_size)
       .def_readwrite("command", &Unit::command)
       .def_readwrite("velocityX", &Unit::velocityX)
       .def_readwrite("velocityY", &Unit::velocityY)
@@ -162,11 +176,42 @@ void init_replayer(py::module& m) {
       .def_readwrite("uid", &Action::uid)
       .def_readwrite("aid", &Action::aid);
 
+  // Bit flags for the fields arguments of load() and ReplayReader
+  py::class_<FrameFields> fields(m_sub, "FrameFields");
+#define DO_FIELD(NAME) fields.attr(#NAME) = uint32_t(FrameFields::NAME)
+  DO_FIELD(UnitBasics);
+  DO_FIELD(UnitDetails);
+  DO_FIELD(UnitOrders);
+  DO_FIELD(UnitCommand);
+  DO_FIELD(Actions);
+  DO_FIELD(Resources);
+  DO_FIELD(Bullets);
+  DO_FIELD(Creep);
+  DO_FIELD(All);
+#undef DO_FIELD
+
   py::class_<Frame>(m_sub, "Frame")
       .def(py::init<>())
       .def(py::init<Frame*>())
-      .def_readwrite("units", &Frame::units)
+      .def_property(
+          "units",
+          [](Frame* self) { return self->units; },
+          [](Frame* self, const PlayerMap<std::vector<Unit>>& units) {
+            self->units = units;
+            self->units_sorted = false;
+          })
+      .def_readonly("units_sorted", &Frame::units_sorted)
+      .def("sortUnits", &Frame::sortUnits)
       .def_readwrite("actions", &Frame::actions)
+      .def_readwrite("orders", &Frame::orders)
+      .def(
+          "unitOrders",
+          [](Frame* self, const Unit& unit) {
+            auto orders = self->unitOrders(unit);
+            return std::vector<Order>(orders.begin(), orders.end());
+          })
+      .def("addOrder", &Frame::addOrder)
+      .def("setOrders", &Frame::setOrders)
       .def_readwrite("resources", &Frame::resources)
       .def_readwrite("bullets", &Frame::bullets)
       .def_readwrite("height", &Frame::height)
@@ -194,7 +239,9 @@ void init_replayer(py::module& m) {
             }
             return map;
           })
-      .def("combine", &Frame::combine)
+      .def(
+          "combine",
+          static_cast<void (Frame::*)(const Frame&)>(&Frame::combine))
       .def("filter", &Frame::filter);
 
   py::class_<Replayer>(m_sub, "Replayer")
@@ -202,13 +249,64 @@ void init_replayer(py::module& m) {
       .def("__len__", &Replayer::size)
       .def(
           "getFrame",
-          &Replayer::getFrame,
-          py::return_value_policy::reference_internal)
+          [](py::object self, size_t i) {
+            auto rep = self.cast<Replayer*>();
+            auto f = rep->getFrame(i);
+            if (f == nullptr || !(rep->isLazy() || rep->isCompact())) {
+              return py::cast(
+                  f, py::return_value_policy::reference_internal, self);
+            }
+            // Lazily loaded or rebuilt frames may be evicted by the next call
+            return py::cast(
+                new Frame(f), py::return_value_policy::take_ownership);
+          })
       .def("push", &Replayer::push)
       .def("setKeyFrame", &Replayer::setKeyFrame)
+      .def("setCacheSize", &Replayer::setCacheSize)
+      .def("setFields", &Replayer::setFields)
+      .def("getFields", &Replayer::getFields)
+      .def("setPredictive", &Replayer::setPredictive)
+      .def("isPredictive", &Replayer::isPredictive)
+      .def("isLazy", &Replayer::isLazy)
+      .def("compact", &Replayer::compact)
+      .def("isCompact", &Replayer::isCompact)
       .def("getKeyFrame", &Replayer::getKeyFrame)
       .def("setNumUnits", &Replayer::setNumUnits)
       .def("getNumUnits", &Replayer::getNumUnits)
+      .def(
+          "getUnitColumns",
+          [](Replayer* self) {
+            UnitColumns cols;
+            {
+              py::gil_scoped_release release;
+              cols = self->getUnitColumns();
+            }
+            py::dict ret;
+#define COLUMN(NAME) ret[py::str(#NAME)] = toArray(std::move(cols.NAME))
+            COLUMN(frameOffsets);
+            COLUMN(frame);
+            COLUMN(playerId);
+            COLUMN(id);
+            COLUMN(type);
+            COLUMN(x);
+            COLUMN(y);
+            COLUMN(pixel_x);
+            COLUMN(pixel_y);
+            COLUMN(health);
+            COLUMN(max_health);
+            COLUMN(shield);
+            COLUMN(max_shield);
+            COLUMN(energy);
+            COLUMN(groundCD);
+            COLUMN(airCD);
+            COLUMN(visible);
+            COLUMN(resources);
+            COLUMN(flags);
+            COLUMN(velocityX);
+            COLUMN(velocityY);
+#undef COLUMN
+            return ret;
+          })
       .def("setMapFromState", &Replayer::setMapFromState)
       .def(
           "setMap",
@@ -298,10 +396,51 @@ void init_replayer(py::module& m) {
           py::arg("path"),
           py::arg("compressed") = true);
 
-  m_sub.def("load", [](const std::string& path) {
-    py::gil_scoped_release release;
-    auto rep = new Replayer();
-    rep->load(path);
-    return rep;
-  });
+  py::class_<ReplayWriter>(m_sub, "ReplayWriter")
+      .def(
+          py::init<const std::string&, uint32_t, bool>(),
+          py::arg("path"),
+          py::arg("keyframe") = 0,
+          py::arg("compressed") = true)
+      .def("__len__", &ReplayWriter::size)
+      .def("setMapFromState", &ReplayWriter::setMapFromState)
+      .def("setPredictive", &ReplayWriter::setPredictive)
+      .def("push", &ReplayWriter::push)
+      .def("close", &ReplayWriter::close)
+      .def("isOpen", &ReplayWriter::isOpen);
+
+  // Frames returned by the reader are overwritten by the next iteration
+  py::class_<ReplayReader>(m_sub, "ReplayReader")
+      .def(
+          py::init<const std::string&, uint32_t>(),
+          py::arg("path"),
+          py::arg("fields") = uint32_t(FrameFields::All))
+      .def("__len__", &ReplayReader::size)
+      .def("__iter__", [](py::object self) { return self; })
+      .def(
+          "__next__",
+          [](ReplayReader* self) {
+            auto f = self->next();
+            if (f == nullptr)
+              throw py::stop_iteration();
+            return f;
+          },
+          py::return_value_policy::reference_internal)
+      .def("position", &ReplayReader::position)
+      .def("getKeyFrame", &ReplayReader::getKeyFrame)
+      .def("getNumUnits", &ReplayReader::getNumUnits);
+
+  m_sub.def(
+      "load",
+      [](const std::string& path, bool lazy, size_t threads, uint32_t fields) {
+        py::gil_scoped_release release;
+        auto rep = new Replayer();
+        rep->setFields(fields);
+        rep->load(path, lazy, threads);
+        return rep;
+      },
+      py::arg("path"),
+      py::arg("lazy") = false,
+      py::arg("threads") = 1,
+      py::arg("fields") = uint32_t(FrameFields::All));
 }
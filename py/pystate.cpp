@@ -57,6 +57,13 @@ void init_state(py::module& torchcraft) {
       .def_readwrite("aliveUnits", &State::aliveUnits)
       .def_readwrite("aliveUnitsConsidered", &State::aliveUnitsConsidered)
       .def_readwrite("units", &State::units)
+      .def_readwrite("orders", &State::orders)
+      .def(
+          "unitOrders",
+          [](State* self, const Unit& unit) {
+            auto orders = self->unitOrders(unit);
+            return std::vector<Order>(orders.begin(), orders.end());
+          })
       .def_readonly("frame", &State::frame)
       .def(
           py::init<bool, std::set<BW::UnitType>>(),
@@ -66,6 +73,8 @@ void init_state(py::module& torchcraft) {
           "only_consider_types",
           &State::onlyConsiderTypes,
           &State::setOnlyConsiderTypes)
+      .def_property(
+          "frame_fields", &State::frameFields, &State::setFrameFields)
       .def("reset", &State::reset)
       .def("clone", [](State* self) { return new State(*self); });
 }
@@ -3,6 +3,8 @@
 #include <pybind11/stl.h>
 #include <sstream>
 
+#include "player_map.h"
+
 #define READPAIR(TYP, VAR) \
   [](TYP* self) { return py::make_tuple(self->VAR[0], self->VAR[1]); }
 
@@ -18,3 +20,12 @@
 std::string fromCamelCaseToLower(const std::string& s);
 
 namespace py = pybind11;
+
+// Per-player maps of frames are converted from and to dicts
+namespace pybind11 {
+namespace detail {
+template <typename T>
+struct type_caster<torchcraft::replayer::PlayerMap<T>>
+    : map_caster<torchcraft::replayer::PlayerMap<T>, int32_t, T> {};
+} // namespace detail
+} // namespace pybind11
@@ -15,8 +15,10 @@ namespace torchcraft {
 namespace replayer { 
 
 Frame::Frame() : RefCounted() {
+  width = height = 0;
   reward = 0;
   is_terminal = 0;
+  units_sorted = false;
 }
 
 Frame::Frame(Frame&& o) : RefCounted() {
@@ -28,12 +30,14 @@ Frame::Frame(const Frame& o)
       units(o.units),
       actions(o.actions),
       resources(o.resources),
+      orders(o.orders),
       bullets(o.bullets),
       creep_map(o.creep_map),
       width(o.width),
       height(o.height) {
   reward = o.reward;
   is_terminal = o.is_terminal;
+  units_sorted = o.units_sorted;
 }
 
 Frame::Frame(const Frame* o)
@@ -41,12 +45,14 @@ Frame::Frame(const Frame* o)
       units(o->units),
       actions(o->actions),
       resources(o->resources),
+      orders(o->orders),
       bullets(o->bullets),
       creep_map(o->creep_map),
       width(o->width),
       height(o->height) {
   reward = o->reward;
   is_terminal = o->is_terminal;
+  units_sorted = o->units_sorted;
 }
 
 
@@ -55,12 +61,14 @@ void Frame::swap(Frame& a, Frame& b) {
   swap(a.units, b.units);
   swap(a.actions, b.actions);
   swap(a.resources, b.resources);
+  swap(a.orders, b.orders);
   swap(a.bullets, b.bullets);
   swap(a.creep_map, b.creep_map);
   swap(a.width, b.width);
   swap(a.height, b.height);
   swap(a.reward, b.reward);
   swap(a.is_terminal, b.is_terminal);
+  swap(a.units_sorted, b.units_sorted);
 }
 
 Frame& Frame::operator=(Frame other) noexcept {
@@ -72,12 +80,63 @@ void Frame::clear() {
   units.clear();
   actions.clear();
   resources.clear();
+  orders.clear();
   bullets.clear();
   creep_map.clear();
   width = 0;
   height = 0;
   reward = 0;
   is_terminal = 0;
+  units_sorted = false;
+}
+
+std::vector<Unit>& Frame::playerUnits(int32_t playerId) {
+  auto it = units.find(playerId);
+  if (it != units.end())
+    return it->second;
+  auto& pu = units[playerId];
+  if (!spare_units_.empty()) {
+    pu = std::move(spare_units_.back());
+    spare_units_.pop_back();
+  }
+  return pu;
+}
+
+void Frame::addOrder(Unit& unit, const Order& order) {
+  if (unit.orders_size == 0) {
+    unit.orders_offset = orders.size();
+  } else if (unit.orders_offset + unit.orders_size != orders.size()) {
+    auto offset = orders.size();
+    orders.reserve(offset + unit.orders_size + 1);
+    for (uint32_t i = 0; i < unit.orders_size; i++) {
+      orders.push_back(orders[unit.orders_offset + i]);
+    }
+    unit.orders_offset = offset;
+  }
+  orders.push_back(order);
+  unit.orders_size++;
+}
+
+void Frame::setOrders(Unit& unit, const std::vector<Order>& unitOrders) {
+  unit.orders_offset = orders.size();
+  unit.orders_size = unitOrders.size();
+  orders.insert(orders.end(), unitOrders.begin(), unitOrders.end());
+}
+
+void Frame::release() {
+  // Not in use anymore, so the pool doesn't keep this frame alive
+  auto pool = std::move(pool_);
+  if (pool == nullptr || !FramePool::put(*pool, this))
+    delete this;
+}
+
+void Frame::sortUnits() {
+  for (auto& player : units) {
+    auto& pu = player.second;
+    if (!std::is_sorted(pu.begin(), pu.end(), detail::orderUnitByiD))
+      std::sort(pu.begin(), pu.end(), detail::orderUnitByiD);
+  }
+  units_sorted = true;
 }
 
 void Frame::filter(int32_t x, int32_t y, Frame& o) const {
@@ -86,11 +145,19 @@ void Frame::filter(int32_t x, int32_t y, Frame& o) const {
         20 * 4 * 20 * 4;
   };
 
+  // Filtering preserves the order of units
+  if (!units_sorted)
+    o.units_sorted = false;
   for (auto& player : units) {
-    o.units[player.first] = std::vector<Unit>();
+    auto& ou = o.units[player.first];
+    ou.clear();
     for (auto& unit : player.second) {
       if (inRadius(unit.x, unit.y)) {
-        o.units[player.first].push_back(unit);
+        ou.push_back(unit);
+        auto uo = unitOrders(unit);
+        ou.back().orders_offset = o.orders.size();
+        ou.back().orders_size = uo.size();
+        o.orders.insert(o.orders.end(), uo.begin(), uo.end());
       }
     }
   }
@@ -101,62 +168,148 @@ void Frame::filter(int32_t x, int32_t y, Frame& o) const {
   }
 }
 
-void Frame::combine(const Frame& next_frame) {
+void detail::sortedIndices(
+    const std::vector<Unit>& units,
+    bool sorted,
+    std::vector<uint32_t>& perm) {
+  perm.resize(units.size());
+  for (size_t i = 0; i < units.size(); i++) {
+    perm[i] = i;
+  }
+  if (sorted)
+    return;
+  std::sort(perm.begin(), perm.end(), [&units](uint32_t a, uint32_t b) {
+    return units[a].id < units[b].id;
+  });
+}
+
+namespace {
+
+// Members of the next frame are copied by combine(const Frame&) and swapped
+// in by combine(Frame&&), which gets a non-const next frame
+template <typename T>
+void take(T& dst, const T& src) {
+  dst = src;
+}
+template <typename T>
+void take(T& dst, T& src) {
+  dst.swap(src);
+}
+
+// Appends the orders in range to pool and points unit to them
+void appendOrders(std::vector<Order>& pool, Unit& unit, OrderRange range) {
+  unit.orders_offset = pool.size();
+  unit.orders_size = range.size();
+  pool.insert(pool.end(), range.begin(), range.end());
+}
+
+// Merges the units of both frames by id. Units of frame are sorted first if
+// needed; those of next are visited in id order through an index
+// permutation. NextFrame is either const Frame or Frame.
+template <typename NextFrame>
+void combineFrames(Frame& frame, NextFrame& next) {
+  // Scratch memory is kept around to avoid allocations in steady state
+  thread_local std::vector<Unit> merged;
+  thread_local std::vector<uint32_t> perm;
+  thread_local std::vector<Order> pool;
+
+  // Combined units have at most the orders of both frames, so the new pool
+  // does not need to grow while orders are appended
+  pool.clear();
+  pool.reserve(frame.orders.size() + next.orders.size());
+  if (!frame.units_sorted) {
+    frame.sortUnits();
+  }
+
   // For units, accumulate presence and commands
-  for (auto& player : next_frame.units) {
+  for (auto& player : frame.units) {
     auto& player_id = player.first;
-    auto& player_units = player.second;
-
-    if (units.count(player_id) == 0) {
-      units.insert(player);
+    auto& pu = player.second;
+    auto nit = next.units.find(player_id);
+    if (nit == next.units.end()) {
+      for (auto& unit : pu) {
+        appendOrders(pool, unit, frame.unitOrders(unit));
+      }
       continue;
     }
+    const auto& nu = nit->second;
+    detail::sortedIndices(nu, next.units_sorted, perm);
 
-    // Build dictionary of uid -> position in current frame unit vector
-    std::unordered_map<int32_t, int32_t> idx;
-    for (unsigned i = 0; i < units[player_id].size(); i++) {
-      idx[units[player_id][i].id] = i;
-    }
-    // Iterate over units in next frame
-    for (auto& unit : player_units) {
-      if (idx.count(unit.id) == 0) {
-        // Unit wasn't in current frame, add it
-        units[player_id].push_back(unit);
-      } else {
-        int32_t i = idx[unit.id];
-        // Take unit state from next frame but accumulate orders
-        // so as to have a vector of all the orders taken
-        std::vector<Order> ords = std::move(units[player_id][i].orders);
-        ords.reserve(ords.size() + unit.orders.size());
-        for (auto& ord : unit.orders) {
-          if (ords.empty() || !(ord == ords.back())) {
-            ords.push_back(ord);
-          }
+    merged.clear();
+    merged.reserve(pu.size() + nu.size());
+    auto cur = pu.begin();
+    for (auto j : perm) {
+      const Unit& unit = nu[j];
+      // Units that are not in the next frame stay as they are
+      for (; cur != pu.end() && cur->id < unit.id; ++cur) {
+        merged.push_back(*cur);
+        appendOrders(pool, merged.back(), frame.unitOrders(*cur));
+      }
+      // Take unit state from next frame but accumulate orders
+      // so as to have a list of all the orders taken
+      merged.push_back(unit);
+      auto offset = pool.size();
+      if (cur != pu.end() && cur->id == unit.id) {
+        auto prev = frame.unitOrders(*cur);
+        pool.insert(pool.end(), prev.begin(), prev.end());
+        ++cur;
+      }
+      for (auto& ord : next.unitOrders(unit)) {
+        if (pool.size() == offset || !(ord == pool.back())) {
+          pool.push_back(ord);
         }
-        units[player_id][i] = unit;
-        units[player_id][i].orders = std::move(ords);
       }
+      merged.back().orders_offset = offset;
+      merged.back().orders_size = pool.size() - offset;
+    }
+    for (; cur != pu.end(); ++cur) {
+      merged.push_back(*cur);
+      appendOrders(pool, merged.back(), frame.unitOrders(*cur));
     }
+    // Units are trivially copyable, and pu keeps its capacity
+    pu.assign(merged.begin(), merged.end());
+
     // For resources: keep the ones of the next frame
-    if (next_frame.resources.find(player_id) != next_frame.resources.end()) {
-      auto next_res = next_frame.resources.at(player_id);
-      resources[player_id].ore = next_res.ore;
-      resources[player_id].gas = next_res.gas;
-      resources[player_id].used_psi = next_res.used_psi;
-      resources[player_id].total_psi = next_res.total_psi;
-      resources[player_id].upgrades = next_res.upgrades;
-      resources[player_id].upgrades_level = next_res.upgrades_level;
-      resources[player_id].techs = next_res.techs;
+    auto rit = next.resources.find(player_id);
+    if (rit != next.resources.end()) {
+      frame.resources[player_id] = rit->second;
+    }
+  }
+  // Players that only appear in next
+  for (auto& player : next.units) {
+    if (frame.units.count(player.first) > 0)
+      continue;
+    auto& pu = frame.playerUnits(player.first);
+    take(pu, player.second);
+    if (!next.units_sorted) {
+      std::sort(pu.begin(), pu.end(), detail::orderUnitByiD);
+    }
+    for (auto& unit : pu) {
+      auto range = next.unitOrders(unit);
+      appendOrders(pool, unit, range);
     }
   }
-  // For other stuff, simply keep that of next_frame
-  actions = next_frame.actions;
-  bullets = next_frame.bullets;
-  creep_map = next_frame.creep_map;
-  width = next_frame.width;
-  height = next_frame.height;
-  reward = next_frame.reward;
-  is_terminal = next_frame.is_terminal;
+  frame.orders.swap(pool);
+
+  // For other stuff, simply keep that of next
+  take(frame.actions, next.actions);
+  take(frame.bullets, next.bullets);
+  take(frame.creep_map, next.creep_map);
+  frame.width = next.width;
+  frame.height = next.height;
+  frame.reward = next.reward;
+  frame.is_terminal = next.is_terminal;
+  frame.units_sorted = true;
+}
+
+} // namespace
+
+void Frame::combine(const Frame& next_frame) {
+  combineFrames(*this, next_frame);
+}
+
+void Frame::combine(Frame&& next_frame) {
+  combineFrames(*this, next_frame);
 }
 
 bool Frame::getCreepAt(uint32_t x, uint32_t y) {
@@ -164,5 +317,64 @@ bool Frame::getCreepAt(uint32_t x, uint32_t y) {
   return (this->creep_map[ind / 8] >> (ind % 8)) & 1;
 }
 
+FramePool::FramePool(size_t maxSize) : shared_(std::make_shared<Shared>()) {
+  shared_->maxSize = maxSize;
+}
+
+FramePool::~FramePool() {
+  std::lock_guard<std::mutex> lock(shared_->mutex);
+  shared_->closed = true;
+}
+
+FramePool::Shared::~Shared() {
+  for (auto f : frames) {
+    delete f;
+  }
+}
+
+Frame* FramePool::get() {
+  Frame* f = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    if (!shared_->frames.empty()) {
+      f = shared_->frames.back();
+      shared_->frames.pop_back();
+    }
+  }
+  if (f == nullptr) {
+    f = new Frame();
+  } else {
+    f->incref(); // Released frames have no references left
+  }
+  f->pool_ = shared_;
+  return f;
+}
+
+size_t FramePool::size() const {
+  std::lock_guard<std::mutex> lock(shared_->mutex);
+  return shared_->frames.size();
+}
+
+bool FramePool::put(Shared& pool, Frame* f) {
+  // Keep the (emptied) unit vectors around for playerUnits(); everything
+  // else keeps its capacity when cleared. They are stacked in reverse so that
+  // players get their previous vectors back if they are added in the same
+  // order.
+  for (auto it = f->units.end(); it != f->units.begin();) {
+    if (f->spare_units_.size() >= 16)
+      break;
+    --it;
+    it->second.clear();
+    f->spare_units_.push_back(std::move(it->second));
+  }
+  f->clear();
+
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  if (pool.closed || pool.frames.size() >= pool.maxSize)
+    return false;
+  pool.frames.push_back(f);
+  return true;
+}
+
 } // namespace replayer
 } // namespace torchcraft
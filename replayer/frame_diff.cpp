@@ -8,13 +8,27 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "frame.h"
+#include "unit_compare.h"
 
 namespace torchcraft {
 namespace replayer {
 
-// This macro maps the member variables of Unit to some IDs
+// This macro maps the member variables of Unit to some IDs. IDs need to be
+// listed in increasing order and be less than 64 (see UnitDiff::var_mask).
 #define _DOALL(F)                     \
   F(x, 0)                             \
   F(y, 1)                             \
@@ -56,6 +70,15 @@ namespace replayer {
   F(command.targetY, 38)              \
   F(command.extra, 39)
 
+// Fields of FrameFields::UnitBasics and FrameFields::UnitCommand; all others
+// are part of FrameFields::UnitDetails
+#define _UNIT_BASICS_MASK                                              \
+  ((1ull << 0) | (1ull << 1) | (1ull << 2) | (1ull << 3) | (1ull << 4) | \
+   (1ull << 5) | (1ull << 11) | (1ull << 12) | (1ull << 26))
+#define _UNIT_COMMAND_MASK (0x3Full << 34)
+// pixel_x and pixel_y, which are decoded with FrameFields::UnitBasics, too
+#define _UNIT_PIXEL_MASK ((1ull << 16) | (1ull << 17))
+
 #define _DOALL_ON_ORDER(F) \
   F(first_frame, 0)        \
   F(type, 1)               \
@@ -67,88 +90,500 @@ FrameDiff frame_diff(Frame& lhs, Frame& rhs) {
   return frame_diff(&lhs, &rhs);
 }
 
-FrameDiff frame_diff(Frame* lhs, Frame* rhs) {
+FrameDiff frame_diff(Frame* lhs, Frame* rhs, bool predictive) {
   FrameDiff df;
+  frame_diff(df, lhs, rhs, predictive);
+  return df;
+}
+
+namespace {
+
+inline int lowestBit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(x);
+#else
+  int i = 0;
+  for (; (x & 1) == 0; x >>= 1) {
+    i++;
+  }
+  return i;
+#endif
+}
+
+// Appends the bytes that differ between lhs and rhs, and the bytes of lhs
+// past the end of rhs. Creep changes are sparse, so most of the map is
+// skipped eight bytes at a time.
+void diffCreep(
+    const std::vector<uint8_t>& lhs,
+    const std::vector<uint8_t>& rhs,
+    std::vector<std::pair<uint32_t, uint8_t>>& out) {
+  auto n = std::min(lhs.size(), rhs.size());
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b;
+    std::memcpy(&a, lhs.data() + i, 8);
+    std::memcpy(&b, rhs.data() + i, 8);
+    if (a == b)
+      continue;
+    for (size_t j = i; j < i + 8; j++) {
+      if (lhs[j] != rhs[j])
+        out.emplace_back(j, lhs[j]);
+    }
+  }
+  for (; i < lhs.size(); i++) {
+    if (i >= n || lhs[i] != rhs[i])
+      out.emplace_back(i, lhs[i]);
+  }
+}
+
+detail::ResourcesDiff diffResources(const Resources& lhs, const Resources& rhs) {
+  detail::ResourcesDiff d;
+  d.ore = lhs.ore - rhs.ore;
+  d.gas = lhs.gas - rhs.gas;
+  d.used_psi = lhs.used_psi - rhs.used_psi;
+  d.total_psi = lhs.total_psi - rhs.total_psi;
+  d.upgrades = lhs.upgrades ^ rhs.upgrades;
+  d.upgrades_level = lhs.upgrades_level ^ rhs.upgrades_level;
+  d.techs = lhs.techs ^ rhs.techs;
+  return d;
+}
+
+Resources addResources(const Resources& r, const detail::ResourcesDiff& d) {
+  Resources res;
+  res.ore = r.ore + d.ore;
+  res.gas = r.gas + d.gas;
+  res.used_psi = r.used_psi + d.used_psi;
+  res.total_psi = r.total_psi + d.total_psi;
+  res.upgrades = r.upgrades ^ d.upgrades;
+  res.upgrades_level = r.upgrades_level ^ d.upgrades_level;
+  res.techs = r.techs ^ d.techs;
+  return res;
+}
+
+// Offsets of the position of a unit predicted from its velocity, see
+// FrameDiff::prediction_frames
+struct Prediction {
+  int32_t x, y, pixel_x, pixel_y;
+};
+
+int32_t predictPixels(double velocity, uint32_t frames) {
+  // Velocities of corrupted diffs may be anything
+  auto v = velocity * frames;
+  if (!(std::abs(v) < 1e6))
+    return 0;
+  return static_cast<int32_t>(std::lround(v));
+}
+
+// Walktile of a pixel position, rounding towards negative infinity
+inline int32_t walktile(int32_t pixel) {
+  return pixel >= 0 ? pixel / 8 : -((7 - pixel) / 8);
+}
+
+Prediction predict(const Unit& u, uint32_t frames) {
+  if (frames == 0)
+    return {0, 0, 0, 0};
+  // x and y are in walktiles of 8 pixels, so they follow the predicted pixel
+  // position. This requires pixel positions to be decoded along with x and y.
+  auto px = predictPixels(u.velocityX, frames);
+  auto py = predictPixels(u.velocityY, frames);
+  return {walktile(u.pixel_x + px) - walktile(u.pixel_x),
+          walktile(u.pixel_y + py) - walktile(u.pixel_y),
+          px,
+          py};
+}
+
+// Predicted offset of the unit field with the given id
+inline int32_t predicted(const Prediction& p, int field) {
+  switch (field) {
+    case 0:
+      return p.x;
+    case 1:
+      return p.y;
+    case 16:
+      return p.pixel_x;
+    case 17:
+      return p.pixel_y;
+    default:
+      return 0;
+  }
+}
+
+// Maps the 32-bit words of Unit (see detail::changedUnitWords()) to the
+// fields of _DOALL and to the parts of UnitDiff
+struct UnitLayout {
+  uint32_t offsets[64];
+  int8_t fieldOfWord[64];
+  uint64_t varWords = 0;
+  uint64_t velocityWords = 0;
+  uint64_t flagsWords = 0;
+  uint64_t orderSizeWords = 0;
+
+  UnitLayout() {
+    std::fill(std::begin(fieldOfWord), std::end(fieldOfWord), -1);
+#define _SET_FIELD(NAME, NUM)                     \
+  offsets[NUM] = offsetof(Unit, NAME);            \
+  fieldOfWord[offsetof(Unit, NAME) / 4] = NUM;    \
+  varWords |= 1ull << (offsetof(Unit, NAME) / 4);
+    _DOALL(_SET_FIELD)
+#undef _SET_FIELD
+    velocityWords = words(offsetof(Unit, velocityX), 2 * sizeof(double));
+    flagsWords = words(offsetof(Unit, flags), sizeof(uint64_t));
+    orderSizeWords = words(offsetof(Unit, orders_size), sizeof(uint32_t));
+  }
+
+  static uint64_t words(size_t offset, size_t size) {
+    return ((1ull << (size / 4)) - 1) << (offset / 4);
+  }
+
+  // Fields of _DOALL that are covered by the given words
+  uint64_t fields(uint64_t words) const {
+    uint64_t mask = 0;
+    for (words &= varWords; words != 0; words &= words - 1) {
+      mask |= 1ull << fieldOfWord[lowestBit(words)];
+    }
+    return mask;
+  }
+
+  int32_t field(const Unit& u, int num) const {
+    int32_t value;
+    std::memcpy(&value, reinterpret_cast<const char*>(&u) + offsets[num], 4);
+    return value;
+  }
+};
+
+const UnitLayout kUnitLayout;
+const uint64_t kPositionFields =
+    (1ull << 0) | (1ull << 1) | (1ull << 16) | (1ull << 17);
+
+// Number of game frames between both frames that explains the motion of
+// units best given their velocities in rhs, by least squares
+uint32_t predictionFrames(Frame* lhs, Frame* rhs) {
+  thread_local std::vector<uint32_t> lhsPerm, rhsPerm;
+  double dv = 0, vv = 0;
+  for (const auto& it : lhs->units) {
+    auto rhsit = rhs->units.find(it.first);
+    if (rhsit == rhs->units.end())
+      continue;
+    const auto& lhsu = it.second;
+    const auto& rhsu = rhsit->second;
+    detail::sortedIndices(lhsu, lhs->units_sorted, lhsPerm);
+    detail::sortedIndices(rhsu, rhs->units_sorted, rhsPerm);
+    auto rpos = rhsPerm.begin();
+    for (auto l : lhsPerm) {
+      const Unit& lu = lhsu[l];
+      while (rpos != rhsPerm.end() && lu.id > rhsu[*rpos].id)
+        rpos++;
+      if (rpos == rhsPerm.end())
+        break;
+      const Unit& ru = rhsu[*rpos];
+      if (lu.id != ru.id)
+        continue;
+      dv += double(lu.pixel_x - ru.pixel_x) * ru.velocityX +
+          double(lu.pixel_y - ru.pixel_y) * ru.velocityY;
+      vv += ru.velocityX * ru.velocityX + ru.velocityY * ru.velocityY;
+    }
+  }
+  if (!(vv > 0) || !(dv > 0))
+    return 0;
+  // Clamp before rounding, tiny velocities would overflow long
+  return static_cast<uint32_t>(std::lround(std::min(dv / vv, 1000.0)));
+}
+
+// Threads that work on the players of a single frame at a time, see
+// setDiffThreads()
+class PlayerPool {
+ public:
+  explicit PlayerPool(size_t numThreads) {
+    // The calling thread works, too
+    for (size_t i = 1; i < numThreads; i++) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~PlayerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Calls fn(i) for i in [0, n) and waits for all calls to finish. The first
+  // exception thrown by fn is rethrown. Returns false without calling fn if
+  // the pool is busy with another frame, e.g. one that is undiffed by a
+  // different thread.
+  bool run(size_t n, const std::function<void(size_t)>& fn) {
+    std::unique_lock<std::mutex> busy(busy_, std::try_to_lock);
+    if (!busy.owns_lock())
+      return false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      next_ = 0;
+      size_ = pending_ = n;
+      error_ = nullptr;
+    }
+    cv_.notify_all();
+    runJobs();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0; });
+    fn_ = nullptr;
+    if (error_)
+      std::rethrow_exception(error_);
+    return true;
+  }
+
+ private:
+  void runJobs() {
+    while (true) {
+      const std::function<void(size_t)>* fn;
+      size_t i;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fn_ == nullptr || next_ >= size_)
+          return;
+        fn = fn_;
+        i = next_++;
+      }
+      try {
+        (*fn)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+          error_ = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0)
+        done_.notify_all();
+    }
+  }
+
+  void work() {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() {
+          return stop_ || (fn_ != nullptr && next_ < size_);
+        });
+        if (stop_)
+          return;
+      }
+      runJobs();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex busy_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_;
+  const std::function<void(size_t)>* fn_ = nullptr;
+  size_t next_ = 0, size_ = 0, pending_ = 0;
+  std::exception_ptr error_;
+  bool stop_ = false;
+};
+
+std::mutex poolMutex;
+std::shared_ptr<PlayerPool> playerPool;
+std::atomic<size_t> parallelMinUnits(std::numeric_limits<size_t>::max());
+
+// Calls fn(i) for each player i in parallel if enabled with setDiffThreads()
+// and if there are enough units to go around. Returns false without calling
+// fn otherwise.
+bool runParallel(
+    size_t numPlayers,
+    size_t numUnits,
+    const std::function<void(size_t)>& fn) {
+  if (numPlayers < 2 || numUnits < parallelMinUnits)
+    return false;
+  std::shared_ptr<PlayerPool> pool;
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    pool = playerPool;
+  }
+  return pool && pool->run(numPlayers, fn);
+}
+
+template <typename F>
+void forEachPlayer(size_t numPlayers, size_t numUnits, F fn) {
+  if (runParallel(numPlayers, numUnits, fn))
+    return;
+  for (size_t i = 0; i < numPlayers; i++) {
+    fn(i);
+  }
+}
+
+size_t countUnits(const Frame* f) {
+  size_t n = 0;
+  for (const auto& player : f->units) {
+    n += player.second.size();
+  }
+  return n;
+}
+
+} // namespace
+
+void setDiffThreads(size_t numThreads, size_t minUnits) {
+  std::lock_guard<std::mutex> lock(poolMutex);
+  if (numThreads > 1) {
+    playerPool = std::make_shared<PlayerPool>(numThreads);
+    parallelMinUnits = minUnits;
+  } else {
+    playerPool = nullptr;
+    parallelMinUnits = std::numeric_limits<size_t>::max();
+  }
+}
+
+void frame_diff(FrameDiff& df, Frame* lhs, Frame* rhs, bool predictive) {
+  // Index permutations are kept around to avoid allocations in steady state.
+  // Players that are diffed in parallel use those of their thread.
+  thread_local std::vector<uint32_t> lhsPerm, rhsPerm;
+  static const std::vector<Unit> noUnits;
+
   df.reward = lhs->reward;
   df.is_terminal = lhs->is_terminal;
   df.bullets = lhs->bullets;
   df.actions = lhs->actions;
-  df.resources = lhs->resources;
-  for (size_t i = 0; i < lhs->creep_map.size(); i++) {
-    if (lhs->creep_map[i] != rhs->creep_map[i])
-      df.creep_map.insert(std::make_pair(i, lhs->creep_map[i]));
+  static const Resources noResources = Resources();
+  df.resources.clear();
+  df.all_resources = false;
+  for (const auto& it : lhs->resources) {
+    auto rit = rhs->resources.find(it.first);
+    df.resources[it.first] = diffResources(
+        it.second, rit == rhs->resources.end() ? noResources : rit->second);
   }
+  df.creep_map.clear();
+  diffCreep(lhs->creep_map, rhs->creep_map, df.creep_map);
+  df.creep_size = lhs->creep_map.size();
 
-  for (auto it : lhs->units) { // Iterates across number of players
+  // Unit diffs of previous calls are overwritten rather than destroyed so
+  // that their vectors keep their capacity
+  df.pids.clear();
+  df.units.resize(lhs->units.size());
+  df.removed.resize(lhs->units.size());
+  df.all_units = false;
+  df.fields = FrameFields::All;
+  df.prediction_frames = predictive ? predictionFrames(lhs, rhs) : 0;
+  for (const auto& it : lhs->units) {
     df.pids.push_back(it.first);
+  }
+  auto diffPlayer = [&](size_t p) {
+    const auto& it = *(lhs->units.begin() + p);
 
-    // Set up the units list
-    df.units.emplace_back();
-    std::vector<detail::UnitDiff>& ul = df.units.back();
-
-    auto lhsu = it.second;
-    auto rhsu = rhs->units.find(it.first) == rhs->units.end()
-        ? std::vector<Unit>()
-        : rhs->units.at(it.first);
-    std::sort(lhsu.begin(), lhsu.end(), detail::orderUnitByiD);
-    std::sort(rhsu.begin(), rhsu.end(), detail::orderUnitByiD);
-    auto rit = rhsu.begin();
-    for (auto lit : lhsu) {
-      while (rit != rhsu.end() && lit.id > rit->id)
-        rit++;
-      ul.emplace_back();
-      detail::UnitDiff& du = ul.back();
+    // Set up the units list. Units that did not change are left out.
+    std::vector<detail::UnitDiff>& ul = df.units[p];
+    std::vector<int32_t>& removed = df.removed[p];
+    removed.clear();
+    const auto& lhsu = it.second;
+    auto rhsit = rhs->units.find(it.first);
+    const auto& rhsu = rhsit == rhs->units.end() ? noUnits : rhsit->second;
+    detail::sortedIndices(lhsu, lhs->units_sorted, lhsPerm);
+    detail::sortedIndices(rhsu, rhs->units_sorted, rhsPerm);
+    ul.resize(lhsu.size());
+    size_t n = 0;
+    auto rpos = rhsPerm.begin();
+    for (auto l : lhsPerm) {
+      const Unit& lit = lhsu[l];
+      for (; rpos != rhsPerm.end() && lit.id > rhsu[*rpos].id; rpos++)
+        removed.push_back(rhsu[*rpos].id);
+      const Unit* rit = rpos != rhsPerm.end() ? &rhsu[*rpos] : nullptr;
+      detail::UnitDiff& du = ul[n];
+      du.var_mask = 0;
+      du.var_diffs.clear();
+      du.order_ids.clear();
+      du.order_diffs.clear();
       du.id = lit.id;
       du.velocityX = lit.velocityX;
       du.velocityY = lit.velocityY;
       du.flags = lit.flags;
-      du.order_size = lit.orders.size();
-      if (rit != rhsu.end() &&
-          lit.id == rit->id) { // Unit exists in both frames
+      auto lorders = lhs->unitOrders(lit);
+      du.order_size = lorders.size();
+      if (rit != nullptr && lit.id == rit->id) { // Unit exists in both frames
+        rpos++;
         int32_t buffer = 0;
-// Fill out diffs for the int32_t variables
-#define _GEN_VAR(NAME, NUM)         \
-  buffer = lit.NAME - rit->NAME;    \
-  if (buffer != 0) {                \
-    du.var_ids.push_back(NUM);      \
-    du.var_diffs.push_back(buffer); \
-  }
-        _DOALL(_GEN_VAR)
-#undef _GEN_VAR
+        // Only fields whose words changed are looked at, plus positions if
+        // they are predicted to change
+        auto changed = detail::changedUnitWords(lit, *rit);
+        auto fields = kUnitLayout.fields(changed);
+        auto prediction = predict(*rit, df.prediction_frames);
+        auto candidates = fields;
+        if (prediction.x != 0 || prediction.y != 0 || prediction.pixel_x != 0 ||
+            prediction.pixel_y != 0)
+          candidates |= kPositionFields;
+        // Fill out diffs for the int32_t variables, in increasing field order
+        for (; candidates != 0; candidates &= candidates - 1) {
+          auto num = lowestBit(candidates);
+          buffer = kUnitLayout.field(lit, num) - kUnitLayout.field(*rit, num) -
+              predicted(prediction, num);
+          if (buffer != 0) {
+            du.var_mask |= 1ull << num;
+            du.var_diffs.push_back(buffer);
+          }
+        }
         // Fill out diffs for orders
-        for (size_t i = 0; i < lit.orders.size(); i++) {
-#define _GEN_VAR(NAME, NUM)                            \
-  if (i >= rit->orders.size())                         \
-    buffer = lit.orders[i].NAME;                       \
-  else                                                 \
-    buffer = lit.orders[i].NAME - rit->orders[i].NAME; \
-  if (buffer != 0) {                                   \
-    du.order_ids.push_back(5 * i + NUM);               \
-    du.order_diffs.push_back(buffer);                  \
+        auto rorders = rhs->unitOrders(*rit);
+        for (size_t i = 0; i < lorders.size(); i++) {
+#define _GEN_VAR(NAME, NUM)                     \
+  if (i >= rorders.size())                      \
+    buffer = lorders[i].NAME;                   \
+  else                                          \
+    buffer = lorders[i].NAME - rorders[i].NAME; \
+  if (buffer != 0) {                            \
+    du.order_ids.push_back(5 * i + NUM);        \
+    du.order_diffs.push_back(buffer);           \
   }
           _DOALL_ON_ORDER(_GEN_VAR)
 #undef _GEN_VAR
         }
+        du.parts = 0;
+        if (changed & kUnitLayout.velocityWords)
+          du.parts |= detail::UnitDiff::Velocity;
+        if (changed & kUnitLayout.flagsWords)
+          du.parts |= detail::UnitDiff::Flags;
+        if (changed & kUnitLayout.orderSizeWords)
+          du.parts |= detail::UnitDiff::OrderSize;
+        // With predictive diffs, units may move without any deltas
+        if (fields == 0 && du.order_ids.empty() && du.parts == 0)
+          continue; // Unchanged
       } else { // Unit only exist in latter frame;
 // Fill out diffs for the int32_t variables
-#define _GEN_VAR(NAME, NUM)  \
-  du.var_ids.push_back(NUM); \
+#define _GEN_VAR(NAME, NUM)   \
+  du.var_mask |= 1ull << NUM; \
   du.var_diffs.push_back(lit.NAME);
         _DOALL(_GEN_VAR)
 #undef _GEN_VAR
         // Fill out diffs for orders
-        for (size_t i = 0; i < lit.orders.size(); i++) {
+        for (size_t i = 0; i < lorders.size(); i++) {
 #define _GEN_VAR(NAME, NUM)            \
   du.order_ids.push_back(5 * i + NUM); \
-  du.order_diffs.push_back(lit.orders[i].NAME);
+  du.order_diffs.push_back(lorders[i].NAME);
           _DOALL_ON_ORDER(_GEN_VAR)
 #undef _GEN_VAR
         }
+        du.parts = detail::UnitDiff::AllParts;
       } // end if
+      n++;
     } // end loop over units
-  } // end loop over players
+    for (; rpos != rhsPerm.end(); rpos++)
+      removed.push_back(rhsu[*rpos].id);
+    ul.resize(n);
+  };
+  forEachPlayer(
+      lhs->units.size(), countUnits(lhs) + countUnits(rhs), diffPlayer);
+}
 
-  return df;
+uint64_t detail::unitVarMask(uint32_t fields) {
+  uint64_t mask = 0;
+  if (fields & FrameFields::UnitBasics)
+    mask |= _UNIT_BASICS_MASK | _UNIT_PIXEL_MASK;
+  if (fields & FrameFields::UnitCommand)
+    mask |= _UNIT_COMMAND_MASK;
+  if (fields & FrameFields::UnitDetails)
+    mask |= ~(_UNIT_BASICS_MASK | _UNIT_COMMAND_MASK);
+  return mask;
 }
 
 Frame* detail::add(Frame* frame, FrameDiff* df) {
@@ -162,49 +597,160 @@ void detail::add(Frame* f, Frame* frame, FrameDiff* df) {
   f->is_terminal = df->is_terminal;
   f->bullets = df->bullets;
   f->actions = df->actions;
-  f->resources = df->resources;
-  f->height = frame->height;
-  f->width = frame->width;
-  f->creep_map = frame->creep_map;
-  for (auto pair : df->creep_map)
+  // Resources are patched into a copy since frame may be f
+  static const Resources noResources = Resources();
+  PlayerMap<Resources> resources;
+  for (const auto& it : df->resources) {
+    auto rit = frame->resources.find(it.first);
+    const auto& base = df->all_resources || rit == frame->resources.end()
+        ? noResources
+        : rit->second;
+    resources[it.first] = addResources(base, it.second);
+  }
+  f->resources = resources;
+  if (f != frame) {
+    f->height = frame->height;
+    f->width = frame->width;
+    f->creep_map = frame->creep_map;
+    if (f->units.empty()) {
+      // Lets recycled frames re-use their unit vectors
+      for (const auto& player : frame->units)
+        f->playerUnits(player.first) = player.second;
+    } else {
+      f->units = frame->units;
+    }
+    f->units_sorted = frame->units_sorted;
+  }
+  // Creep maps hold one bit per build tile. Diffs resize them if the map
+  // changed; older diffs don't know the size and can only grow them.
+  auto maxCreep = size_t(f->height / 4) * (f->width / 4) / 8;
+  if (df->creep_size >= 0) {
+    if (size_t(df->creep_size) > maxCreep)
+      throw std::runtime_error("Corrupted frame diff: invalid creep size");
+    f->creep_map.resize(df->creep_size);
+  }
+  for (const auto& pair : df->creep_map) {
+    if (pair.first >= f->creep_map.size()) {
+      if (df->creep_size >= 0 || pair.first >= maxCreep)
+        throw std::runtime_error("Corrupted frame diff: invalid creep");
+      f->creep_map.resize(pair.first + 1);
+    }
     f->creep_map[pair.first] = pair.second;
+  }
 
-  // We only save units if f and frame are the same pointer
-  std::unordered_map<int32_t, std::vector<Unit>> saved_units;
-  if (f == frame) {
-    saved_units = std::move(frame->units);
+  // Units are patched in place: players and units that are not part of the
+  // diff are erased, new units are default-initialized.
+  for (auto it = f->units.begin(); it != f->units.end();) {
+    if (std::find(df->pids.begin(), df->pids.end(), it->first) ==
+        df->pids.end())
+      it = f->units.erase(it);
+    else
+      ++it;
   }
-  auto& frame_units = (f == frame) ? saved_units : frame->units;
-  f->units.clear();
 
-  for (size_t i = 0; i < df->pids.size(); i++) {
-    auto pid = df->pids[i];
-    f->units[pid] = std::vector<Unit>();
-
-    auto f_units = frame_units.find(pid) == frame_units.end()
-        ? std::vector<Unit>()
-        : frame_units.at(pid);
-    std::sort(f_units.begin(), f_units.end(), detail::orderUnitByiD);
-
-    // Should be in order
-    auto fit = f_units.begin();
-    for (auto du : df->units[i]) {
-      while (fit != f_units.end() && fit->id < du.id)
-        fit++;
-
-      if (fit != f_units.end() && du.id == fit->id)
-        f->units[pid].emplace_back(*fit);
-      else
-        f->units[pid].emplace_back();
-
-      Unit& u = f->units[pid].back();
-      u.id = du.id;
-      u.velocityX = du.velocityX;
-      u.velocityY = du.velocityY;
-      u.flags = du.flags;
-
-      for (size_t k = 0; k < du.var_diffs.size(); k++) {
-        switch (du.var_ids[k]) { // assumes int32_t are 0 initted
+  // Orders are rebuilt into a separate pool so that those of frame can be
+  // read while units are patched, even if f == frame
+  thread_local std::vector<Order> pool;
+  thread_local std::vector<std::vector<Unit>*> unitLists;
+  // Thread-local buffers are named through references in code that may run
+  // on other threads
+  auto& lists = unitLists;
+  pool.clear();
+  lists.clear();
+  static const std::vector<int32_t> noRemoved;
+  size_t numUnits = 0;
+  for (auto pid : df->pids) {
+    lists.push_back(&f->playerUnits(pid));
+    numUnits += lists.back()->size();
+  }
+  for (const auto& dunits : df->units) {
+    numUnits += dunits.size();
+  }
+  // Appends the orders of the units of the i-th player to out, and sets
+  // their offsets relative to the start of out
+  auto addPlayer = [&](size_t i, std::vector<Order>& out) {
+    auto& units = *lists[i];
+    const auto& dunits = df->units[i];
+    const auto& removed =
+        i < df->removed.size() ? df->removed[i] : noRemoved;
+    if (!f->units_sorted) {
+      std::sort(units.begin(), units.end(), detail::orderUnitByiD);
+    }
+
+    // Diffs list units by id. Keep the units that are still around: those
+    // that are not removed, or only listed ones for diffs of older versions.
+    size_t kept = 0, added = 0;
+    auto dit = dunits.begin();
+    auto rit = removed.begin();
+    for (size_t j = 0; j < units.size(); j++) {
+      auto id = units[j].id;
+      for (; dit != dunits.end() && dit->id < id; dit++)
+        added++;
+      while (rit != removed.end() && *rit < id)
+        rit++;
+      bool listed = dit != dunits.end() && dit->id == id;
+      if (listed)
+        dit++;
+      if (df->all_units ? listed : rit == removed.end() || *rit != id) {
+        if (kept != j)
+          units[kept] = std::move(units[j]);
+        kept++;
+      } else if (listed) {
+        added++; // Removed and back again
+      }
+    }
+    added += dunits.end() - dit;
+    // ...and make room for new ones, moving kept units back into place
+    units.resize(kept + added);
+    for (size_t j = units.size(), d = dunits.size(); j > kept;) {
+      j--;
+      if (kept > 0 && (d == 0 || units[kept - 1].id >= dunits[d - 1].id)) {
+        if (d > 0 && units[kept - 1].id == dunits[d - 1].id)
+          d--;
+        kept--;
+        units[j] = std::move(units[kept]);
+      } else {
+        d--;
+        units[j] = Unit(); // assumes int32_t are 0 initted
+        units[j].id = dunits[d].id;
+      }
+    }
+
+    dit = dunits.begin();
+    for (auto& u : units) {
+      // Orders of units start from those of the base frame
+      auto base = frame->unitOrders(u);
+      auto offset = out.size();
+      u.orders_offset = offset;
+      if (dit == dunits.end() || dit->id != u.id) { // Unchanged
+        out.insert(out.end(), base.begin(), base.end());
+        u.orders_size = base.size();
+        continue;
+      }
+      auto& du = *dit++;
+      // Positions are predicted from the velocity in the base frame, and
+      // only for fields that were decoded. New units have no velocity.
+      auto prediction = predict(u, df->prediction_frames);
+      if (df->fields & FrameFields::UnitBasics) {
+        u.x += prediction.x;
+        u.y += prediction.y;
+      }
+      if (df->fields & (FrameFields::UnitBasics | FrameFields::UnitDetails)) {
+        u.pixel_x += prediction.pixel_x;
+        u.pixel_y += prediction.pixel_y;
+      }
+      if (du.parts & detail::UnitDiff::Velocity) {
+        u.velocityX = du.velocityX;
+        u.velocityY = du.velocityY;
+      }
+      if (du.parts & detail::UnitDiff::Flags) {
+        u.flags = du.flags;
+      }
+
+      size_t k = 0;
+      for (auto mask = du.var_mask; mask != 0 && k < du.var_diffs.size();
+           mask &= mask - 1, k++) {
+        switch (lowestBit(mask)) {
 #define _SWITCHES(NAME, NUM)   \
   case NUM:                    \
     u.NAME += du.var_diffs[k]; \
@@ -214,21 +760,53 @@ void detail::add(Frame* f, Frame* frame, FrameDiff* df) {
         }
       }
 
-      u.orders.resize(du.order_size);
+      size_t order_size = (du.parts & detail::UnitDiff::OrderSize)
+          ? size_t(du.order_size)
+          : base.size();
+      out.insert(
+          out.end(),
+          base.begin(),
+          base.begin() + std::min(base.size(), order_size));
+      out.resize(offset + order_size);
+      u.orders_size = order_size;
       for (size_t k = 0; k < du.order_diffs.size(); k++) {
-        auto order_n = du.order_ids[k] / 5;
+        size_t order_n = du.order_ids[k] / 5;
         auto field_n = du.order_ids[k] % 5;
+        if (order_n >= order_size)
+          continue;
         switch (field_n) {
-#define _SWITCHES(NAME, NUM)                     \
-  case NUM:                                      \
-    u.orders[order_n].NAME += du.order_diffs[k]; \
+#define _SWITCHES(NAME, NUM)                         \
+  case NUM:                                          \
+    out[offset + order_n].NAME += du.order_diffs[k]; \
     break;
           _DOALL_ON_ORDER(_SWITCHES)
 #undef _SWITCHES
         }
       }
     }
+  };
+
+  // In parallel, orders go to a pool per player first
+  thread_local std::vector<std::vector<Order>> playerPools;
+  auto& pools = playerPools;
+  pools.resize(df->pids.size());
+  auto parallel = runParallel(df->pids.size(), numUnits, [&](size_t i) {
+    pools[i].clear();
+    addPlayer(i, pools[i]);
+  });
+  for (size_t i = 0; i < df->pids.size(); i++) {
+    if (!parallel) {
+      addPlayer(i, pool);
+      continue;
+    }
+    uint32_t offset = pool.size();
+    for (auto& u : *lists[i]) {
+      u.orders_offset += offset;
+    }
+    pool.insert(pool.end(), pools[i].begin(), pools[i].end());
   }
+  f->orders.swap(pool);
+  f->units_sorted = true;
 }
 
 Frame* frame_undiff(FrameDiff* lhs, Frame* rhs) {
@@ -270,14 +848,17 @@ bool detail::frameEq(Frame* f1, Frame* f2, bool debug) {
     _TEST(_EQ(->bullets[i].y));
   }
   _TEST(f1->resources.size() == f2->resources.size());
-  for (size_t i = 0; i < f1->resources.size(); i++) {
-    _TEST(_EQ(->resources[i].ore));
-    _TEST(_EQ(->resources[i].gas));
-    _TEST(_EQ(->resources[i].used_psi));
-    _TEST(_EQ(->resources[i].total_psi));
-    _TEST(_EQ(->resources[i].upgrades));
-    _TEST(_EQ(->resources[i].upgrades_level));
-    _TEST(_EQ(->resources[i].techs));
+  for (const auto& elem : f1->resources) {
+    _TEST(f2->resources.find(elem.first) != f2->resources.end());
+    const auto& f1res = elem.second;
+    const auto& f2res = f2->resources.at(elem.first);
+    _TEST(_EQV(res, .ore));
+    _TEST(_EQV(res, .gas));
+    _TEST(_EQV(res, .used_psi));
+    _TEST(_EQV(res, .total_psi));
+    _TEST(_EQV(res, .upgrades));
+    _TEST(_EQV(res, .upgrades_level));
+    _TEST(_EQV(res, .techs));
   }
   _TEST(f1->creep_map.size() == f2->creep_map.size());
   for (size_t i = 0; i < f1->creep_map.size(); i++)
@@ -310,9 +891,11 @@ bool detail::frameEq(Frame* f1, Frame* f2, bool debug) {
       _TEST(_EQV(units, [i].velocityX));
       _TEST(_EQV(units, [i].velocityY));
       _TEST(_EQV(units, [i].flags));
-      _TEST(_EQV(units, [i].orders.size()));
-      for (size_t k = 0; k < f1units[i].orders.size(); k++)
-        _TEST(_EQV(units, [i].orders[k]));
+      auto f1orders = f1->unitOrders(f1units[i]);
+      auto f2orders = f2->unitOrders(f2units[i]);
+      _TEST(_EQV(orders, .size()));
+      for (size_t k = 0; k < f1orders.size(); k++)
+        _TEST(_EQV(orders, [k]));
     }
   }
   return true;
@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <stdexcept>
 
 #include "frame.h"
 #include "flatbuffer_conversions.h"
@@ -16,6 +17,122 @@
 namespace torchcraft {
 namespace replayer {
 
+namespace {
+
+void putUVarint(std::vector<uint8_t>& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(v));
+}
+
+template <typename It>
+uint32_t getUVarint(It& it, It end, const char* what) {
+  uint32_t v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (it == end)
+      break;
+    uint8_t b = *it++;
+    v |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+      return v;
+  }
+  throw std::runtime_error(std::string("Corrupted frame diff: ") + what);
+}
+
+template <typename It>
+uint64_t getUVarint64(It& it, It end, const char* what) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 70; shift += 7) {
+    if (it == end)
+      break;
+    uint8_t b = *it++;
+    v |= static_cast<uint64_t>(b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+      return v;
+  }
+  throw std::runtime_error(std::string("Corrupted frame diff: ") + what);
+}
+
+// Unit field deltas are stored as zigzag-encoded varints: small deltas of
+// either sign take a single byte.
+void putVarint(std::vector<uint8_t>& out, int32_t v) {
+  putUVarint(
+      out, (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31));
+}
+
+template <typename It>
+int32_t getVarint(It& it, It end, const char* what = "invalid unit deltas") {
+  auto z = getUVarint(it, end, what);
+  return static_cast<int32_t>((z >> 1) ^ (~(z & 1) + 1));
+}
+
+// Bits of the presence byte of resource_deltas, in the order of the fields
+enum ResourceFields : uint8_t {
+  Ore = 1 << 0,
+  Gas = 1 << 1,
+  UsedPsi = 1 << 2,
+  TotalPsi = 1 << 3,
+  Upgrades = 1 << 4,
+  UpgradesLevel = 1 << 5,
+  Techs = 1 << 6,
+};
+
+void putResourcesDiff(
+    std::vector<uint8_t>& out,
+    int32_t playerId,
+    const detail::ResourcesDiff& d) {
+  putVarint(out, playerId);
+  out.push_back(
+      (d.ore != 0 ? Ore : 0) | (d.gas != 0 ? Gas : 0) |
+      (d.used_psi != 0 ? UsedPsi : 0) | (d.total_psi != 0 ? TotalPsi : 0) |
+      (d.upgrades != 0 ? Upgrades : 0) |
+      (d.upgrades_level != 0 ? UpgradesLevel : 0) |
+      (d.techs != 0 ? Techs : 0));
+  for (auto v : {d.ore, d.gas, d.used_psi, d.total_psi}) {
+    if (v != 0)
+      putVarint(out, v);
+  }
+  for (auto v : {d.upgrades, d.upgrades_level, d.techs}) {
+    if (v != 0)
+      putUVarint(out, v);
+  }
+}
+
+template <typename It>
+std::pair<int32_t, detail::ResourcesDiff> getResourcesDiff(It& it, It end) {
+  static const char* what = "invalid resources";
+  auto playerId = getVarint(it, end, what);
+  if (it == end)
+    throw std::runtime_error(std::string("Corrupted frame diff: ") + what);
+  uint8_t changed = *it++;
+  detail::ResourcesDiff d = detail::ResourcesDiff();
+  for (auto field : {std::make_pair(Ore, &d.ore),
+                     std::make_pair(Gas, &d.gas),
+                     std::make_pair(UsedPsi, &d.used_psi),
+                     std::make_pair(TotalPsi, &d.total_psi)}) {
+    if (changed & field.first)
+      *field.second = getVarint(it, end, what);
+  }
+  for (auto field : {std::make_pair(Upgrades, &d.upgrades),
+                     std::make_pair(UpgradesLevel, &d.upgrades_level),
+                     std::make_pair(Techs, &d.techs)}) {
+    if (changed & field.first)
+      *field.second = getUVarint64(it, end, what);
+  }
+  return std::make_pair(playerId, d);
+}
+
+size_t popCount(uint64_t x) {
+  size_t n = 0;
+  for (; x != 0; x &= x - 1)
+    n++;
+  return n;
+}
+
+} // namespace
+
 std::ostream& operator<<(std::ostream& out, const FrameDiff& frameDiff) {
   flatbuffers::FlatBufferBuilder builder;
   frameDiff.addToFlatBufferBuilder(builder);
@@ -33,18 +150,19 @@ std::istream& operator>>(std::istream& in, FrameDiff& frameDiff) {
 
 flatbuffers::Offset<fbs::FrameDiff> FrameDiff::addToFlatBufferBuilder(flatbuffers::FlatBufferBuilder& builder) const {
 
-  auto packFrameDiffCreep = [](const std::pair<int32_t, int32_t> creepPair) {
-    return fbs::FrameDiffCreep(creepPair.first, creepPair.second);
-  };
 
-  auto packUnitDiffContainer = [&builder](const std::vector<detail::UnitDiff>& unitDiffs) {
-    auto packUnitDiff = [&builder](const detail::UnitDiff& unitDiff) {
-      
-      auto var_ids_offsets = builder.CreateVector(unitDiff.var_ids);
-      builder.Finish(var_ids_offsets);
-      
-      auto var_diffs_offsets = builder.CreateVector(unitDiff.var_diffs);
-      builder.Finish(var_diffs_offsets);
+  std::vector<uint8_t> deltas;
+  auto packUnitDiffContainer = [&builder, &deltas](
+      const std::vector<detail::UnitDiff>& unitDiffs,
+      const std::vector<int32_t>* removed) {
+    auto packUnitDiff = [&builder, &deltas](const detail::UnitDiff& unitDiff) {
+
+      deltas.clear();
+      for (auto d : unitDiff.var_diffs) {
+        putVarint(deltas, d);
+      }
+      auto var_deltas_offsets = builder.CreateVector(deltas);
+      builder.Finish(var_deltas_offsets);
       
       auto order_ids_offsets = builder.CreateVector(unitDiff.order_ids);
       builder.Finish(order_ids_offsets);
@@ -53,15 +171,24 @@ flatbuffers::Offset<fbs::FrameDiff> FrameDiff::addToFlatBufferBuilder(flatbuffer
       builder.Finish(order_diffs_offsets);
       
       fbs::UnitDiffBuilder fbsUnitDiffBuilder(builder);
-      fbsUnitDiffBuilder.add_var_ids(var_ids_offsets);
-      fbsUnitDiffBuilder.add_var_diffs(var_diffs_offsets);
+      fbsUnitDiffBuilder.add_var_mask(unitDiff.var_mask);
+      fbsUnitDiffBuilder.add_var_deltas(var_deltas_offsets);
       fbsUnitDiffBuilder.add_order_ids(order_ids_offsets);
       fbsUnitDiffBuilder.add_order_diffs(order_diffs_offsets);
       fbsUnitDiffBuilder.add_id(unitDiff.id);
-      fbsUnitDiffBuilder.add_order_size(unitDiff.order_size);
-      fbsUnitDiffBuilder.add_velocityX(unitDiff.velocityX);
-      fbsUnitDiffBuilder.add_velocityY(unitDiff.velocityY);
-      fbsUnitDiffBuilder.add_flags(unitDiff.flags);
+      // Parts that did not change are left out
+      if (unitDiff.parts & detail::UnitDiff::OrderSize) {
+        fbsUnitDiffBuilder.add_order_size(unitDiff.order_size);
+      }
+      if (unitDiff.parts & detail::UnitDiff::Velocity) {
+        fbsUnitDiffBuilder.add_velocityX(unitDiff.velocityX);
+        fbsUnitDiffBuilder.add_velocityY(unitDiff.velocityY);
+      }
+      if (unitDiff.parts & detail::UnitDiff::Flags) {
+        fbsUnitDiffBuilder.add_flags(unitDiff.flags);
+      }
+      fbsUnitDiffBuilder.add_skipped(
+          detail::UnitDiff::AllParts & ~unitDiff.parts);
       auto output = fbsUnitDiffBuilder.Finish();
       builder.Finish(output);
       return output;
@@ -72,30 +199,87 @@ flatbuffers::Offset<fbs::FrameDiff> FrameDiff::addToFlatBufferBuilder(flatbuffer
     auto unitDiffsOffsets = builder.CreateVector(fbsUnitDiffs);
     builder.Finish(unitDiffsOffsets);
 
+    // Written even if empty, unless all units are listed
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> removedOffsets;
+    if (removed) {
+      removedOffsets = builder.CreateVector(*removed);
+      builder.Finish(removedOffsets);
+    }
+
     fbs::UnitDiffContainerBuilder fbsUnitDiffContainerBuilder(builder);
     fbsUnitDiffContainerBuilder.add_units(unitDiffsOffsets);
+    if (removed) {
+      fbsUnitDiffContainerBuilder.add_removed(removedOffsets);
+    }
     auto output = fbsUnitDiffContainerBuilder.Finish();
     builder.Finish(output);
     return output;
   };
 
-  std::vector<fbs::FrameDiffCreep> fbsCreep(creep_map.size());
   std::vector<fbs::Bullet> fbsBullets(bullets.size());
-  std::vector<flatbuffers::Offset<fbs::ResourcesOfPlayer>> fbsResourcesOfPlayer(resources.size());
+  std::vector<flatbuffers::Offset<fbs::ResourcesOfPlayer>> fbsResourcesOfPlayer;
   std::vector<flatbuffers::Offset<fbs::ActionsOfPlayer>> fbsActionsOfPlayer(actions.size());  
   std::vector<flatbuffers::Offset<fbs::UnitDiffContainer>> fbsUnitDiffContainers(units.size());
 
-  std::transform(creep_map.begin(), creep_map.end(), fbsCreep.begin(), packFrameDiffCreep);
   std::transform(bullets.begin(), bullets.end(), fbsBullets.begin(), packBullet);
-  std::transform(resources.begin(), resources.end(), fbsResourcesOfPlayer.begin(), packResourcesOfPlayer(builder));
+  // Resources of older versions are written back as they were read
+  std::vector<uint8_t> resourceDeltas;
+  for (const auto& it : resources) {
+    if (!all_resources) {
+      putResourcesDiff(resourceDeltas, it.first, it.second);
+      continue;
+    }
+    const auto& d = it.second;
+    Resources r = {d.ore,
+                   d.gas,
+                   d.used_psi,
+                   d.total_psi,
+                   d.upgrades,
+                   d.upgrades_level,
+                   d.techs};
+    fbsResourcesOfPlayer.push_back(
+        packResourcesOfPlayer(builder)(std::make_pair(it.first, r)));
+  }
   std::transform(actions.begin(), actions.end(), fbsActionsOfPlayer.begin(), packActionsOfPlayer(builder));   
-  std::transform(units.begin(), units.end(), fbsUnitDiffContainers.begin(), packUnitDiffContainer);
+  static const std::vector<int32_t> noRemoved;
+  for (size_t i = 0; i < units.size(); i++) {
+    fbsUnitDiffContainers[i] = packUnitDiffContainer(
+        units[i],
+        all_units ? nullptr : i < removed.size() ? &removed[i] : &noRemoved);
+  }
 
   auto pidsOffsets = builder.CreateVector(pids);
   builder.Finish(pidsOffsets);
   
-  auto creepMapOffsets = builder.CreateVectorOfStructs(fbsCreep);
-  builder.Finish(creepMapOffsets);
+  // Consecutive changed bytes are grouped into runs
+  auto creep = &creep_map;
+  std::vector<std::pair<uint32_t, uint8_t>> sortedCreep;
+  if (!std::is_sorted(creep_map.begin(), creep_map.end())) {
+    sortedCreep = creep_map;
+    std::sort(sortedCreep.begin(), sortedCreep.end());
+    creep = &sortedCreep;
+  }
+  std::vector<uint8_t> creepRuns, creepValues;
+  creepValues.reserve(creep->size());
+  uint32_t runEnd = 0;
+  for (size_t i = 0; i < creep->size();) {
+    auto start = (*creep)[i].first;
+    uint32_t len = 1;
+    while (i + len < creep->size() && (*creep)[i + len].first == start + len)
+      len++;
+    putUVarint(creepRuns, start - runEnd);
+    putUVarint(creepRuns, len);
+    for (uint32_t k = 0; k < len; k++) {
+      creepValues.push_back((*creep)[i + k].second);
+    }
+    i += len;
+    runEnd = start + len;
+  }
+  auto creepRunsOffsets = builder.CreateVector(creepRuns);
+  builder.Finish(creepRunsOffsets);
+
+  auto creepValuesOffsets = builder.CreateVector(creepValues);
+  builder.Finish(creepValuesOffsets);
   
   auto bulletsOffsets = builder.CreateVectorOfStructs(fbsBullets);
   builder.Finish(bulletsOffsets);
@@ -103,8 +287,18 @@ flatbuffers::Offset<fbs::FrameDiff> FrameDiff::addToFlatBufferBuilder(flatbuffer
   auto actionsOffsets = builder.CreateVector(fbsActionsOfPlayer);
   builder.Finish(actionsOffsets);
   
-  auto resourcesOffsets = builder.CreateVector(fbsResourcesOfPlayer);
-  builder.Finish(resourcesOffsets);
+  // Either one or the other is written
+  flatbuffers::Offset<flatbuffers::Vector<
+      flatbuffers::Offset<fbs::ResourcesOfPlayer>>>
+      resourcesOffsets;
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> resourceDeltasOffsets;
+  if (all_resources) {
+    resourcesOffsets = builder.CreateVector(fbsResourcesOfPlayer);
+    builder.Finish(resourcesOffsets);
+  } else {
+    resourceDeltasOffsets = builder.CreateVector(resourceDeltas);
+    builder.Finish(resourceDeltasOffsets);
+  }
   
   auto unitDiffsOffsets = builder.CreateVector(fbsUnitDiffContainers);
   builder.Finish(unitDiffsOffsets);
@@ -113,38 +307,104 @@ flatbuffers::Offset<fbs::FrameDiff> FrameDiff::addToFlatBufferBuilder(flatbuffer
   fbsFrameDiffBuilder.add_reward(reward);
   fbsFrameDiffBuilder.add_is_terminal(is_terminal);
   fbsFrameDiffBuilder.add_pids(pidsOffsets); 
-  fbsFrameDiffBuilder.add_creep_map(creepMapOffsets);
+  fbsFrameDiffBuilder.add_creep_runs(creepRunsOffsets);
+  fbsFrameDiffBuilder.add_creep_values(creepValuesOffsets);
+  fbsFrameDiffBuilder.add_creep_size(creep_size);
   fbsFrameDiffBuilder.add_bullets(bulletsOffsets);
-  fbsFrameDiffBuilder.add_resources(resourcesOffsets);
+  if (all_resources) {
+    fbsFrameDiffBuilder.add_resources(resourcesOffsets);
+  } else {
+    fbsFrameDiffBuilder.add_resource_deltas(resourceDeltasOffsets);
+  }
   fbsFrameDiffBuilder.add_actions(actionsOffsets);
   fbsFrameDiffBuilder.add_unitDiffContainers(unitDiffsOffsets);
+  fbsFrameDiffBuilder.add_prediction_frames(prediction_frames);
   auto output = fbsFrameDiffBuilder.Finish();
   builder.Finish(output);
   return output;
 }
 
-void FrameDiff::readFromFlatBufferTable(const fbs::FrameDiff& fbsFrameDiff) {
+void FrameDiff::readFromFlatBufferTable(
+    const fbs::FrameDiff& fbsFrameDiff,
+    uint32_t fields) {
 
-  auto unpackUnits = [](const fbs::UnitDiffContainer* fbsUnitDiffContainer) {
-    auto unpackUnit = [](const fbs::UnitDiff* fbsUnitDiff) {
+  auto varMask = detail::unitVarMask(fields);
+  auto unpackUnits = [fields, varMask](const fbs::UnitDiffContainer* fbsUnitDiffContainer) {
+    auto unpackUnit = [fields, varMask](const fbs::UnitDiff* fbsUnitDiff) {
       detail::UnitDiff unitDiff;
-      auto fbsVarIds = fbsUnitDiff->var_ids();
-      auto fbsVarDiffs = fbsUnitDiff->var_diffs();
+      auto fbsVarDeltas = fbsUnitDiff->var_deltas();
       auto fbsOrderIds = fbsUnitDiff->order_ids();
       auto fbsOrderDiffs = fbsUnitDiff->order_diffs();
-      unitDiff.var_ids.resize(fbsVarIds->size());
-      unitDiff.var_diffs.resize(fbsVarDiffs->size());
-      unitDiff.order_ids.resize(fbsOrderIds->size());
-      unitDiff.order_diffs.resize(fbsOrderDiffs->size());
-      std::copy(fbsVarIds->begin(), fbsVarIds->end(), unitDiff.var_ids.begin());
-      std::copy(fbsVarDiffs->begin(), fbsVarDiffs->end(), unitDiff.var_diffs.begin());
-      std::copy(fbsOrderIds->begin(), fbsOrderIds->end(), unitDiff.order_ids.begin());
-      std::copy(fbsOrderDiffs->begin(), fbsOrderDiffs->end(), unitDiff.order_diffs.begin());
+      if (fbsVarDeltas) {
+        unitDiff.var_mask = fbsUnitDiff->var_mask();
+        unitDiff.var_diffs.reserve(popCount(unitDiff.var_mask));
+        auto it = fbsVarDeltas->begin();
+        while (it != fbsVarDeltas->end()) {
+          unitDiff.var_diffs.push_back(getVarint(it, fbsVarDeltas->end()));
+        }
+      } else {
+        // Written by older versions: (field id, delta) pairs in any order
+        auto fbsVarIds = fbsUnitDiff->var_ids();
+        auto fbsVarDiffs = fbsUnitDiff->var_diffs();
+        if (!fbsVarIds || !fbsVarDiffs ||
+            fbsVarIds->size() != fbsVarDiffs->size()) {
+          throw std::runtime_error("Corrupted frame diff: invalid unit deltas");
+        }
+        int32_t byId[64];
+        unitDiff.var_mask = 0;
+        for (flatbuffers::uoffset_t i = 0; i < fbsVarIds->size(); i++) {
+          auto id = fbsVarIds->Get(i);
+          if (id < 0 || id >= 64) {
+            throw std::runtime_error("Corrupted frame diff: invalid unit deltas");
+          }
+          unitDiff.var_mask |= uint64_t(1) << id;
+          byId[id] = fbsVarDiffs->Get(i);
+        }
+        for (int id = 0; id < 64; id++) {
+          if (unitDiff.var_mask & (uint64_t(1) << id))
+            unitDiff.var_diffs.push_back(byId[id]);
+        }
+      }
+      if (unitDiff.var_diffs.size() != popCount(unitDiff.var_mask)) {
+        throw std::runtime_error("Corrupted frame diff: invalid unit deltas");
+      }
+      if ((unitDiff.var_mask & ~varMask) != 0) {
+        // Drop the deltas of fields that are not decoded
+        size_t n = 0, k = 0;
+        for (auto mask = unitDiff.var_mask; mask != 0; mask &= mask - 1, k++) {
+          if (varMask & mask & (~mask + 1))
+            unitDiff.var_diffs[n++] = unitDiff.var_diffs[k];
+        }
+        unitDiff.var_diffs.resize(n);
+        unitDiff.var_mask &= varMask;
+      }
+      // Parts that are not decoded are left as they are in the base frame,
+      // which was decoded with the same fields
+      unitDiff.parts = detail::UnitDiff::AllParts & ~fbsUnitDiff->skipped();
+      if (fields & FrameFields::UnitOrders) {
+        unitDiff.order_ids.resize(fbsOrderIds->size());
+        unitDiff.order_diffs.resize(fbsOrderDiffs->size());
+        std::copy(fbsOrderIds->begin(), fbsOrderIds->end(), unitDiff.order_ids.begin());
+        std::copy(fbsOrderDiffs->begin(), fbsOrderDiffs->end(), unitDiff.order_diffs.begin());
+        unitDiff.order_size = fbsUnitDiff->order_size();
+      } else {
+        unitDiff.parts &= ~detail::UnitDiff::OrderSize;
+        unitDiff.order_size = 0;
+      }
       unitDiff.id = fbsUnitDiff->id();
-      unitDiff.order_size = fbsUnitDiff->order_size();
-      unitDiff.velocityX = fbsUnitDiff->velocityX ();
-      unitDiff.velocityY = fbsUnitDiff->velocityY();
-      unitDiff.flags = fbsUnitDiff->flags();
+      if (fields & (FrameFields::UnitBasics | FrameFields::UnitDetails)) {
+        unitDiff.velocityX = fbsUnitDiff->velocityX();
+        unitDiff.velocityY = fbsUnitDiff->velocityY();
+      } else {
+        unitDiff.parts &= ~detail::UnitDiff::Velocity;
+        unitDiff.velocityX = unitDiff.velocityY = 0;
+      }
+      if (fields & FrameFields::UnitBasics) {
+        unitDiff.flags = fbsUnitDiff->flags();
+      } else {
+        unitDiff.parts &= ~detail::UnitDiff::Flags;
+        unitDiff.flags = 0;
+      }
       return unitDiff;
     };
 
@@ -155,16 +415,27 @@ void FrameDiff::readFromFlatBufferTable(const fbs::FrameDiff& fbsFrameDiff) {
       fbsUnitDiffs->end(),
       unitDiffs.begin(),
       unpackUnit);
+    // frame_undiff() merges units by id
+    if (!std::is_sorted(
+            unitDiffs.begin(), unitDiffs.end(), [](
+                const detail::UnitDiff& a, const detail::UnitDiff& b) {
+              return a.id < b.id;
+            })) {
+      throw std::runtime_error("Corrupted frame diff: unsorted units");
+    }
     return unitDiffs;
   };
 
   auto unpackCreep = [](const fbs::FrameDiffCreep* fbsCreep) {
-    return std::make_pair(fbsCreep->index(), fbsCreep->creep());
+    return std::make_pair(
+        static_cast<uint32_t>(fbsCreep->index()),
+        static_cast<uint8_t>(fbsCreep->creep()));
   };
 
   auto frameDiff = this;
   auto fbsPids = fbsFrameDiff.pids();
-  auto fbsCreep = fbsFrameDiff.creep_map();
+  auto fbsCreepRuns = fbsFrameDiff.creep_runs();
+  auto fbsCreepValues = fbsFrameDiff.creep_values();
   auto fbsBullets = fbsFrameDiff.bullets();
   auto fbsResourcesOfPlayers = fbsFrameDiff.resources();
   auto fbsActionsOfPlayers = fbsFrameDiff.actions();
@@ -175,44 +446,91 @@ void FrameDiff::readFromFlatBufferTable(const fbs::FrameDiff& fbsFrameDiff) {
   std::copy(fbsPids->begin(), fbsPids->end(), pids.begin());
   
   creep_map.clear();
-  std::transform(
-    fbsCreep->begin(),
-    fbsCreep->end(),
-    std::inserter(creep_map, creep_map.begin()),
-    unpackCreep);
+  creep_size = fields & FrameFields::Creep ? fbsFrameDiff.creep_size() : -1;
+  if (!(fields & FrameFields::Creep)) {
+    // Not decoded
+  } else if (fbsCreepRuns && fbsCreepValues) {
+    creep_map.reserve(fbsCreepValues->size());
+    auto it = fbsCreepRuns->begin();
+    uint32_t runEnd = 0;
+    while (it != fbsCreepRuns->end()) {
+      auto start = runEnd + getUVarint(it, fbsCreepRuns->end(), "invalid creep");
+      auto len = getUVarint(it, fbsCreepRuns->end(), "invalid creep");
+      if (len > fbsCreepValues->size() - creep_map.size()) {
+        throw std::runtime_error("Corrupted frame diff: invalid creep");
+      }
+      for (uint32_t k = 0; k < len; k++) {
+        creep_map.emplace_back(
+            start + k, fbsCreepValues->Get(creep_map.size()));
+      }
+      runEnd = start + len;
+    }
+  } else {
+    // Written by older versions, in no particular order
+    auto fbsCreep = fbsFrameDiff.creep_map();
+    std::transform(
+      fbsCreep->begin(),
+      fbsCreep->end(),
+      std::back_inserter(creep_map),
+      unpackCreep);
+    std::sort(creep_map.begin(), creep_map.end());
+  }
     
     
   bullets.clear();
-  bullets.resize(fbsBullets->size());
-  std::transform(
-    fbsBullets->begin(),
-    fbsBullets->end(),
-    bullets.begin(),
-    unpackBullet);
+  if (fields & FrameFields::Bullets) {
+    bullets.resize(fbsBullets->size());
+    std::transform(
+      fbsBullets->begin(),
+      fbsBullets->end(),
+      bullets.begin(),
+      unpackBullet);
+  }
     
   resources.clear();
-  std::transform(
-    fbsResourcesOfPlayers->begin(),
-    fbsResourcesOfPlayers->end(),
-    std::inserter(resources, resources.end()),
-    unpackResources);
+  auto fbsResourceDeltas = fbsFrameDiff.resource_deltas();
+  all_resources = fbsResourceDeltas == nullptr;
+  if (!(fields & FrameFields::Resources)) {
+    // Not decoded
+  } else if (fbsResourceDeltas) {
+    auto it = fbsResourceDeltas->begin();
+    while (it != fbsResourceDeltas->end()) {
+      if (!resources.insert(getResourcesDiff(it, fbsResourceDeltas->end()))
+               .second)
+        throw std::runtime_error("Corrupted frame diff: duplicate resources");
+    }
+  } else if (fbsResourcesOfPlayers) {
+    // Written by older versions, with the resources of the frame
+    for (auto fbsResourcesOfPlayer : *fbsResourcesOfPlayers) {
+      auto r = unpackResources(fbsResourcesOfPlayer);
+      resources[r.first] = {r.second.ore,
+                            r.second.gas,
+                            r.second.used_psi,
+                            r.second.total_psi,
+                            r.second.upgrades,
+                            r.second.upgrades_level,
+                            r.second.techs};
+    }
+  }
     
   actions.clear();
-  std::for_each(
-    fbsActionsOfPlayers->begin(),
-    fbsActionsOfPlayers->end(),
-    [frameDiff](const fbs::ActionsOfPlayer* fbsActionsOfPlayer) {
-      auto playerId = fbsActionsOfPlayer->playerId();
-      auto fbsActions = fbsActionsOfPlayer->actions();
-      auto& playerActions = frameDiff->actions[playerId];
-      playerActions.clear();
-      playerActions.resize(fbsActions->size());
-      std::transform(
-        fbsActions->begin(),
-        fbsActions->end(),
-        playerActions.begin(),
-        unpackAction);
-    });
+  if (fields & FrameFields::Actions) {
+    std::for_each(
+      fbsActionsOfPlayers->begin(),
+      fbsActionsOfPlayers->end(),
+      [frameDiff](const fbs::ActionsOfPlayer* fbsActionsOfPlayer) {
+        auto playerId = fbsActionsOfPlayer->playerId();
+        auto fbsActions = fbsActionsOfPlayer->actions();
+        auto& playerActions = frameDiff->actions[playerId];
+        playerActions.clear();
+        playerActions.resize(fbsActions->size());
+        std::transform(
+          fbsActions->begin(),
+          fbsActions->end(),
+          playerActions.begin(),
+          unpackAction);
+      });
+  }
     
   units.clear();
   units.resize(fbsUnitDiffContainers->size());
@@ -222,8 +540,25 @@ void FrameDiff::readFromFlatBufferTable(const fbs::FrameDiff& fbsFrameDiff) {
     units.begin(),
     unpackUnits);
 
+  removed.clear();
+  removed.resize(fbsUnitDiffContainers->size());
+  all_units = false;
+  for (flatbuffers::uoffset_t i = 0; i < fbsUnitDiffContainers->size(); i++) {
+    auto fbsRemoved = fbsUnitDiffContainers->Get(i)->removed();
+    if (!fbsRemoved) {
+      all_units = true;
+      continue;
+    }
+    removed[i].assign(fbsRemoved->begin(), fbsRemoved->end());
+    if (!std::is_sorted(removed[i].begin(), removed[i].end())) {
+      throw std::runtime_error("Corrupted frame diff: unsorted units");
+    }
+  }
+
   reward = fbsFrameDiff.reward();
   is_terminal = fbsFrameDiff.is_terminal();
+  prediction_frames = fbsFrameDiff.prediction_frames();
+  this->fields = fields;
 }
 
 } // namespace replayer
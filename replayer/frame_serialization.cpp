@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <iterator>
 
 #include "frame.h"
 #include "flatbuffer_conversions.h"
@@ -32,8 +33,8 @@ std::istream& operator>>(std::istream& in, Frame& frame) {
 }
 
 flatbuffers::Offset<fbs::Frame> Frame::addToFlatBufferBuilder(flatbuffers::FlatBufferBuilder& builder) const {
-  auto packUnitsOfPlayer = [&builder](const std::pair<int32_t, std::vector<Unit>>& unitPair) {
-    auto packUnit = [&builder](const Unit& unit) {
+  auto packUnitsOfPlayer = [&builder, this](const std::pair<int32_t, std::vector<Unit>>& unitPair) {
+    auto packUnit = [&builder, this](const Unit& unit) {
       auto packOrder = [&builder](const Order& order) {
         return fbs::Order(
           order.first_frame,
@@ -43,8 +44,9 @@ flatbuffers::Offset<fbs::Frame> Frame::addToFlatBufferBuilder(flatbuffers::FlatB
           order.targetY);
       };
 
-      std::vector<fbs::Order> fbsOrders(unit.orders.size());
-      std::transform(unit.orders.begin(), unit.orders.end(), fbsOrders.begin(), packOrder);
+      auto unitOrders = this->unitOrders(unit);
+      std::vector<fbs::Order> fbsOrders(unitOrders.size());
+      std::transform(unitOrders.begin(), unitOrders.end(), fbsOrders.begin(), packOrder);
 
       auto ordersOffset = builder.CreateVectorOfStructs(fbsOrders);
       builder.Finish(ordersOffset);
@@ -154,9 +156,12 @@ flatbuffers::Offset<fbs::Frame> Frame::addToFlatBufferBuilder(flatbuffers::FlatB
   return output;
 };
 
-void Frame::readFromFlatBufferTable(const fbs::Frame& fbsFrame) {
+void Frame::readFromFlatBufferTable(
+    const fbs::Frame& fbsFrame,
+    uint32_t fields) {
 
-  auto unpackUnit = [](const fbs::Unit* fbsUnit) {
+  auto frame = this;
+  auto unpackUnit = [fields, frame](const fbs::Unit* fbsUnit) {
     auto unpackOrder = [](const fbs::Order* fbsOrder) {
       Order order;
       order.first_frame = fbsOrder->first_frame();
@@ -167,61 +172,73 @@ void Frame::readFromFlatBufferTable(const fbs::Frame& fbsFrame) {
       return order;
     };
 
-    Unit unit;
-
-    auto fbsOrders = fbsUnit->orders();
-    unit.orders.resize(fbsOrders->size());
-    std::transform(fbsOrders->begin(), fbsOrders->end(), unit.orders.begin(), unpackOrder);
-
-    auto fbsCommand = fbsUnit->command();
-    unit.command.frame = fbsCommand->frame();
-    unit.command.type = fbsCommand->type();
-    unit.command.targetId = fbsCommand->targetId();
-    unit.command.targetX = fbsCommand->targetX();
-    unit.command.targetY = fbsCommand->targetY();
-    unit.command.extra = fbsCommand->extra();
-
+    Unit unit = Unit();
     unit.id = fbsUnit->id();
-    unit.x = fbsUnit->x();
-    unit.y = fbsUnit->y();
-    unit.health = fbsUnit->health();
-    unit.max_health = fbsUnit->max_health();
-    unit.shield = fbsUnit->shield();
-    unit.max_shield = fbsUnit->max_shield();
-    unit.energy = fbsUnit->energy();
-    unit.maxCD = fbsUnit->maxCD();
-    unit.groundCD = fbsUnit->groundCD();
-    unit.airCD = fbsUnit->airCD();
-    unit.flags = fbsUnit->flags();
-    unit.visible = fbsUnit->visible();
-    unit.type = fbsUnit->type();
-    unit.armor = fbsUnit->armor();
-    unit.shieldArmor = fbsUnit->shieldArmor();
-    unit.size = fbsUnit->size();
-    unit.pixel_x = fbsUnit->pixel_x();
-    unit.pixel_y = fbsUnit->pixel_y();
-    unit.pixel_size_x = fbsUnit->pixel_size_x();
-    unit.pixel_size_y = fbsUnit->pixel_size_y();
-    unit.groundATK = fbsUnit->groundATK();
-    unit.airATK = fbsUnit->airATK();
-    unit.groundDmgType = fbsUnit->groundDmgType();
-    unit.airDmgType = fbsUnit->airDmgType();
-    unit.groundRange = fbsUnit->groundRange();
-    unit.airRange = fbsUnit->airRange();
-    unit.velocityX = fbsUnit->velocityX();
-    unit.velocityY = fbsUnit->velocityY();
-    unit.playerId = fbsUnit->playerId();
-    unit.resources = fbsUnit->resources();
-    unit.buildTechUpgradeType = fbsUnit->buildTechUpgradeType();
-    unit.remainingBuildTrainTime = fbsUnit->remainingBuildTrainTime();
-    unit.remainingUpgradeResearchTime = fbsUnit->remainingUpgradeResearchTime();
-    unit.spellCD = fbsUnit->spellCD();
-    unit.associatedUnit = fbsUnit->associatedUnit();
-    unit.associatedCount = fbsUnit->associatedCount();
+
+    if (fields & FrameFields::UnitOrders) {
+      auto fbsOrders = fbsUnit->orders();
+      unit.orders_offset = frame->orders.size();
+      unit.orders_size = fbsOrders->size();
+      std::transform(fbsOrders->begin(), fbsOrders->end(), std::back_inserter(frame->orders), unpackOrder);
+    }
+
+    if (fields & FrameFields::UnitCommand) {
+      auto fbsCommand = fbsUnit->command();
+      unit.command.frame = fbsCommand->frame();
+      unit.command.type = fbsCommand->type();
+      unit.command.targetId = fbsCommand->targetId();
+      unit.command.targetX = fbsCommand->targetX();
+      unit.command.targetY = fbsCommand->targetY();
+      unit.command.extra = fbsCommand->extra();
+    }
+
+    if (fields & FrameFields::UnitBasics) {
+      unit.x = fbsUnit->x();
+      unit.y = fbsUnit->y();
+      unit.health = fbsUnit->health();
+      unit.max_health = fbsUnit->max_health();
+      unit.shield = fbsUnit->shield();
+      unit.max_shield = fbsUnit->max_shield();
+      unit.flags = fbsUnit->flags();
+      unit.visible = fbsUnit->visible();
+      unit.type = fbsUnit->type();
+      unit.playerId = fbsUnit->playerId();
+    }
+
+    if (fields & (FrameFields::UnitBasics | FrameFields::UnitDetails)) {
+      unit.velocityX = fbsUnit->velocityX();
+      unit.velocityY = fbsUnit->velocityY();
+      unit.pixel_x = fbsUnit->pixel_x();
+      unit.pixel_y = fbsUnit->pixel_y();
+    }
+
+    if (fields & FrameFields::UnitDetails) {
+      unit.energy = fbsUnit->energy();
+      unit.maxCD = fbsUnit->maxCD();
+      unit.groundCD = fbsUnit->groundCD();
+      unit.airCD = fbsUnit->airCD();
+      unit.armor = fbsUnit->armor();
+      unit.shieldArmor = fbsUnit->shieldArmor();
+      unit.size = fbsUnit->size();
+      unit.pixel_size_x = fbsUnit->pixel_size_x();
+      unit.pixel_size_y = fbsUnit->pixel_size_y();
+      unit.groundATK = fbsUnit->groundATK();
+      unit.airATK = fbsUnit->airATK();
+      unit.groundDmgType = fbsUnit->groundDmgType();
+      unit.airDmgType = fbsUnit->airDmgType();
+      unit.groundRange = fbsUnit->groundRange();
+      unit.airRange = fbsUnit->airRange();
+      unit.resources = fbsUnit->resources();
+      unit.buildTechUpgradeType = fbsUnit->buildTechUpgradeType();
+      unit.remainingBuildTrainTime = fbsUnit->remainingBuildTrainTime();
+      unit.remainingUpgradeResearchTime = fbsUnit->remainingUpgradeResearchTime();
+      unit.spellCD = fbsUnit->spellCD();
+      unit.associatedUnit = fbsUnit->associatedUnit();
+      unit.associatedCount = fbsUnit->associatedCount();
+    }
     return unit;
   };
 
-  auto frame = this;
   auto fbsCreep = fbsFrame.creep_map();
   auto fbsBullets = fbsFrame.bullets();
   auto fbsResourcesOfPlayers = fbsFrame.resources();
@@ -229,51 +246,60 @@ void Frame::readFromFlatBufferTable(const fbs::Frame& fbsFrame) {
   auto fbsUnitsOfPlayers = fbsFrame.units();
 
   creep_map.clear();
-  creep_map.resize(fbsCreep->size());
-  std::copy(
-    fbsCreep->begin(),
-    fbsCreep->end(),
-    creep_map.begin());
+  if (fields & FrameFields::Creep) {
+    creep_map.resize(fbsCreep->size());
+    std::copy(
+      fbsCreep->begin(),
+      fbsCreep->end(),
+      creep_map.begin());
+  }
 
   bullets.clear();
-  bullets.resize(fbsBullets->size());
-  std::transform(
-    fbsBullets->begin(),
-    fbsBullets->end(),
-    bullets.begin(),
-    unpackBullet);
+  if (fields & FrameFields::Bullets) {
+    bullets.resize(fbsBullets->size());
+    std::transform(
+      fbsBullets->begin(),
+      fbsBullets->end(),
+      bullets.begin(),
+      unpackBullet);
+  }
 
   resources.clear();
-  std::transform(
-    fbsResourcesOfPlayers->begin(),
-    fbsResourcesOfPlayers->end(),
-    std::inserter(resources, resources.begin()),
-    unpackResources);
+  if (fields & FrameFields::Resources) {
+    std::transform(
+      fbsResourcesOfPlayers->begin(),
+      fbsResourcesOfPlayers->end(),
+      std::inserter(resources, resources.begin()),
+      unpackResources);
+  }
 
   actions.clear();
-  std::for_each(
-    fbsActionsOfPlayers->begin(),
-    fbsActionsOfPlayers->end(),
-    [frame](const fbs::ActionsOfPlayer* fbsActionsOfPlayer) {
-      auto playerId = fbsActionsOfPlayer->playerId();
-      auto fbsActions = fbsActionsOfPlayer->actions();
-      auto& playerActions = frame->actions[playerId];
-      playerActions.resize(fbsActions->size());
-      std::transform(
-        fbsActions->begin(),
-        fbsActions->end(),
-        playerActions.begin(),
-        unpackAction);
-    });
+  if (fields & FrameFields::Actions) {
+    std::for_each(
+      fbsActionsOfPlayers->begin(),
+      fbsActionsOfPlayers->end(),
+      [frame](const fbs::ActionsOfPlayer* fbsActionsOfPlayer) {
+        auto playerId = fbsActionsOfPlayer->playerId();
+        auto fbsActions = fbsActionsOfPlayer->actions();
+        auto& playerActions = frame->actions[playerId];
+        playerActions.resize(fbsActions->size());
+        std::transform(
+          fbsActions->begin(),
+          fbsActions->end(),
+          playerActions.begin(),
+          unpackAction);
+      });
+  }
 
   units.clear();
+  orders.clear();
   std::for_each(
     fbsUnitsOfPlayers->begin(),
     fbsUnitsOfPlayers->end(),
     [frame, unpackUnit](const fbs::UnitsOfPlayer* fbsUnitsOfPlayer) {
       auto playerId = fbsUnitsOfPlayer->playerId();
       auto fbsUnits = fbsUnitsOfPlayer->units();
-      auto& playerUnits = frame->units[playerId];
+      auto& playerUnits = frame->playerUnits(playerId);
       playerUnits.resize(fbsUnits->size());
       std::transform(
         fbsUnits->begin(),
@@ -281,6 +307,7 @@ void Frame::readFromFlatBufferTable(const fbs::Frame& fbsFrame) {
         playerUnits.begin(),
         unpackUnit);
     });
+  sortUnits();
 
   width = fbsFrame.width();
   height = fbsFrame.height();
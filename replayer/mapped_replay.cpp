@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "mapped_replay.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "replay_header.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace torchcraft {
+namespace replayer {
+
+namespace {
+
+// First bytes of a Zstd frame (little-endian 0xFD2FB528)
+const uint8_t zstdMagic[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+// Parses one of the space-separated integers of the replay header
+int64_t parseInt(const uint8_t*& p, const uint8_t* end) {
+  while (p < end && *p == ' ')
+    p++;
+  bool negative = p < end && *p == '-';
+  if (negative)
+    p++;
+  if (p >= end || *p < '0' || *p > '9')
+    throw std::runtime_error("Corrupted replay: invalid header");
+  int64_t v = 0;
+  while (p < end && *p >= '0' && *p <= '9' && v < (int64_t(1) << 48))
+    v = v * 10 + (*p++ - '0');
+  return negative ? -v : v;
+}
+
+template <typename T>
+const T* getTable(const uint8_t* data, size_t size, bool verify) {
+  if (verify) {
+    flatbuffers::Verifier verifier(data, size);
+    if (!verifier.VerifyBuffer<T>()) {
+      throw std::runtime_error("Mapped FlatBuffer table failed verification");
+    }
+  }
+  return flatbuffers::GetRoot<T>(data);
+}
+
+} // namespace
+
+MappedReplay::MappedReplay(const std::string& path, bool verify)
+    : verify_(verify) {
+  map(path);
+  try {
+    parse();
+  } catch (...) {
+    unmap();
+    throw;
+  }
+}
+
+MappedReplay::~MappedReplay() {
+  unmap();
+}
+
+#ifdef _WIN32
+
+void MappedReplay::map(const std::string& path) {
+  file_ = CreateFileA(
+      path.c_str(),
+      GENERIC_READ,
+      FILE_SHARE_READ,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    file_ = nullptr;
+    throw std::runtime_error("Cannot open file to map replay");
+  }
+  LARGE_INTEGER size;
+  GetFileSizeEx(file_, &size);
+  size_ = size.QuadPart;
+  if (size_ == 0)
+    return;
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ != nullptr) {
+    data_ = static_cast<const uint8_t*>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  }
+  if (data_ == nullptr) {
+    unmap();
+    throw std::runtime_error("Cannot map replay file");
+  }
+}
+
+void MappedReplay::unmap() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+  if (file_)
+    CloseHandle(file_);
+  data_ = nullptr;
+  mapping_ = file_ = nullptr;
+}
+
+#else
+
+void MappedReplay::map(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Cannot open file to map replay");
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot stat replay file");
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Cannot map replay file");
+    }
+    data_ = static_cast<const uint8_t*>(addr);
+  }
+  close(fd); // The mapping keeps a reference to the file
+}
+
+void MappedReplay::unmap() {
+  if (data_)
+    munmap(const_cast<uint8_t*>(data_), size_);
+  data_ = nullptr;
+}
+
+#endif // _WIN32
+
+void MappedReplay::parse() {
+  auto p = data_;
+  auto end = data_ + size_;
+  if (size_ >= sizeof(zstdMagic) &&
+      std::memcmp(data_, zstdMagic, sizeof(zstdMagic)) == 0) {
+    throw std::runtime_error("Compressed replays cannot be memory-mapped");
+  }
+
+  // Same layout as operator>>(std::istream&, Replayer&)
+  int64_t nFrames = -1;
+  bool streamed;
+  bool binary = ReplayHeader::hasMagic(p, size_);
+  if (binary) {
+    if (size_ < ReplayHeader::size)
+      throw std::runtime_error("Corrupted replay: truncated header");
+    ReplayHeader header;
+    header.decode(p);
+    p += ReplayHeader::size;
+    keyframe_ = header.keyframe;
+    mapHeight_ = header.height;
+    mapWidth_ = header.width;
+    streamed = header.streamed();
+    if (!streamed)
+      nFrames = header.numFrames;
+    if (nFrames > (end - p) / int64_t(sizeof(size_t)))
+      throw std::runtime_error("Corrupted replay: truncated file");
+  } else {
+    auto diffed = parseInt(p, end);
+    streamed = diffed == -1;
+    if (diffed == 0 || streamed) {
+      keyframe_ = parseInt(p, end);
+      mapHeight_ = parseInt(p, end);
+    } else {
+      mapHeight_ = diffed;
+    }
+    mapWidth_ = parseInt(p, end);
+    if (mapHeight_ <= 0 || mapWidth_ <= 0 || mapHeight_ > 10000 ||
+        mapWidth_ > 10000)
+      throw std::runtime_error("Corrupted replay: invalid map size");
+    p++; // Skip space
+  }
+  size_t mapSize = size_t(mapHeight_) * mapWidth_;
+  if (size_t(end - p) < mapSize)
+    throw std::runtime_error("Corrupted replay: truncated map data");
+  mapData_ = p;
+  p += mapSize;
+
+  if (!binary && !streamed) {
+    nFrames = parseInt(p, end);
+    if (nFrames < 0)
+      throw std::runtime_error("Corrupted replay: invalid number of frames");
+    p++; // Skip space
+  }
+
+  // Frames are prefixed with their size, see streaming_flatbuffers.h.
+  // Streamed replays end with an empty frame.
+  if (!streamed)
+    frames_.reserve(nFrames);
+  for (int64_t i = 0; streamed || i < nFrames; i++) {
+    size_t frameSize;
+    if (size_t(end - p) < sizeof(frameSize))
+      throw std::runtime_error("Corrupted replay: truncated frame");
+    std::memcpy(&frameSize, p, sizeof(frameSize));
+    p += sizeof(frameSize);
+    if (streamed && frameSize == 0)
+      break;
+    if (size_t(end - p) < frameSize)
+      throw std::runtime_error("Corrupted replay: truncated frame");
+    frames_.push_back({p, frameSize});
+    p += frameSize;
+  }
+}
+
+const fbs::Frame* MappedReplay::getFrameTable(size_t i) const {
+  if (i >= frames_.size() || !isKeyFrame(i))
+    return nullptr;
+  return getTable<fbs::Frame>(frames_[i].data, frames_[i].size, verify_);
+}
+
+const fbs::FrameDiff* MappedReplay::getFrameDiffTable(size_t i) const {
+  if (i >= frames_.size() || isKeyFrame(i))
+    return nullptr;
+  return getTable<fbs::FrameDiff>(frames_[i].data, frames_[i].size, verify_);
+}
+
+} // namespace replayer
+} // namespace torchcraft
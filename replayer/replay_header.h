@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Binary header of replay files, shared by Replayer, ReplayWriter,
+ * ReplayReader and MappedReplay.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace torchcraft {
+namespace replayer {
+
+namespace detail {
+
+const char replayMagic[] = {'T', 'C', 'R', 'P'};
+
+inline void putLE(uint8_t* p, uint64_t v, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    p[i] = uint8_t(v >> (8 * i));
+  }
+}
+
+inline uint64_t getLE(const uint8_t* p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++) {
+    v |= uint64_t(p[i]) << (8 * i);
+  }
+  return v;
+}
+
+// CRC-32 (IEEE 802.3), computed bitwise since it only covers a few bytes
+inline uint32_t crc32(const uint8_t* data, size_t size) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+} // namespace detail
+
+// Fixed-size header at the start of replay files. Layout (all binary versions),
+// with all integers in little-endian byte order:
+//   offset  size
+//        0     4  magic "TCRP"
+//        4     2  version
+//        6     2  flags
+//        8     4  keyframe
+//       12     4  map height
+//       16     4  map width
+//       20     8  number of frames
+//       28     4  CRC-32 of bytes 0-27
+// It is followed by height * width bytes of map data and the frames. Replays
+// written before this header was introduced start with space-separated
+// decimal integers instead; they are reported as version 0.
+// Files of all versions can still be read. Changes of the frames per version:
+//   1  first version with this header
+//   2  unit diffs as a field mask and varint-encoded deltas (fbs::UnitDiff)
+//   3  creep diffs as runs of changed bytes (fbs::FrameDiff)
+//   4  unchanged units left out of diffs, removed ones listed
+//      (fbs::UnitDiffContainer)
+//   5  unit positions may be predicted from velocities
+//      (FrameDiff::prediction_frames)
+//   6  resources diffed field by field (fbs::FrameDiff)
+struct ReplayHeader {
+  enum Flags : uint16_t {
+    // The number of frames is only known once all frames have been written
+    // (see ReplayWriter). Frames are terminated by an empty one and the
+    // frame count is stored after them.
+    Streamed = 1 << 0,
+  };
+
+  static const size_t size = 32;
+  static const uint16_t currentVersion = 6;
+  static const uint32_t maxMapSize = 10000;
+
+  uint16_t version = currentVersion;
+  uint16_t flags = 0;
+  uint32_t keyframe = 0;
+  uint32_t height = 0;
+  uint32_t width = 0;
+  uint64_t numFrames = 0;
+
+  bool binary() const {
+    return version > 0;
+  }
+  bool streamed() const {
+    return (flags & Streamed) != 0;
+  }
+
+  static bool hasMagic(const uint8_t* data, size_t size) {
+    return size >= 4 && std::memcmp(data, detail::replayMagic, 4) == 0;
+  }
+
+  void encode(uint8_t* out) const {
+    std::memcpy(out, detail::replayMagic, 4);
+    detail::putLE(out + 4, version, 2);
+    detail::putLE(out + 6, flags, 2);
+    detail::putLE(out + 8, keyframe, 4);
+    detail::putLE(out + 12, height, 4);
+    detail::putLE(out + 16, width, 4);
+    detail::putLE(out + 20, numFrames, 8);
+    detail::putLE(out + 28, detail::crc32(out, 28), 4);
+  }
+
+  // Decodes and validates the first `size` bytes of data
+  void decode(const uint8_t* data) {
+    if (!hasMagic(data, size))
+      throw std::runtime_error("Corrupted replay: invalid header magic");
+    if (detail::getLE(data + 28, 4) != detail::crc32(data, 28))
+      throw std::runtime_error("Corrupted replay: header checksum mismatch");
+    version = detail::getLE(data + 4, 2);
+    if (version == 0 || version > currentVersion)
+      throw std::runtime_error("Unsupported replay version");
+    flags = detail::getLE(data + 6, 2);
+    keyframe = detail::getLE(data + 8, 4);
+    height = detail::getLE(data + 12, 4);
+    width = detail::getLE(data + 16, 4);
+    numFrames = detail::getLE(data + 20, 8);
+    if (height == 0 || width == 0 || height > maxMapSize || width > maxMapSize)
+      throw std::runtime_error("Corrupted replay: invalid map size");
+  }
+};
+
+} // namespace replayer
+} // namespace torchcraft
@@ -9,6 +9,16 @@
 
 #include "replayer.h"
 #include <bitset>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "replay_header.h"
+#include "streaming_flatbuffers.h"
 
 #ifdef WITH_ZSTD
 #include "zstdstream.h"
@@ -19,75 +29,341 @@ namespace replayer {
 
 // Serialization
 
-std::ostream& operator<<(std::ostream& out, const Replayer& o) {
-  auto height = o.map.height;
-  auto width = o.map.width;
-  auto data = o.map.data.data();
+namespace {
 
-  if (o.keyframe != 0)
-    out << 0 << " " << o.keyframe << " ";
-  out << height << " " << width << " ";
-  out.write((const char*)data, height * width); // Write map data as raw bytes
+// A replay consists of a ReplayHeader, the map data, the size-prefixed
+// frames and a tail holding the numUnits table:
+//   count:u32 {key:i32 value:i32}...
+// For streamed replays (see ReplayHeader::Streamed), the frames are
+// terminated by an empty one and the tail starts with the frame count (u64).
+//
+// operator<< appends a keyframe index after the tail so that lazy loading can
+// seek straight to any keyframe:
+//   "TCRI" tailOffset nOffsets offsets[nOffsets] indexOffset "TCRI"
+// All integers are little-endian uint64_t. Offsets are in bytes from the start
+// of the replay; tailOffset points to the tail. The trailing (indexOffset,
+// magic) pair has a fixed size so that the index can be found from the end of
+// a file.
+//
+// Replays written before the binary header (version 0) use space-separated
+// decimal integers for the header and the tail instead:
+//   [0 keyframe ]height width <map>nFrames <frames>count {key value }...
+// or, for streamed replays, "-1 keyframe height width <map>" and a tail
+// starting with "nFrames ".
+const char indexMagic[] = {'T', 'C', 'R', 'I'};
+const size_t indexFooterSize = sizeof(uint64_t) + sizeof(indexMagic);
 
-  auto kf = o.keyframe == 0 ? 1 : o.keyframe;
-  out << o.frames.size() << " ";
-  for (size_t i = 0; i < o.frames.size(); i++) {
-    if (i % kf == 0)
-      out << *o.frames[i];
-    else
-      out << frame_diff(o.frames[i], o.frames[i - 1]);
+// Frame count of streamed replays before the tail has been read
+const size_t unknownFrames = size_t(-1);
+
+// Minimum number of frames per chunk of a compressed replay, and per batch
+// when decoding concurrently
+const size_t minChunkFrames = 64;
+
+// First bytes of a Zstd frame (little-endian 0xFD2FB528)
+const uint8_t zstdMagic[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+void writeU64(std::ostream& out, uint64_t v) {
+  uint8_t buf[sizeof(v)];
+  detail::putLE(buf, v, sizeof(v));
+  out.write(reinterpret_cast<const char*>(buf), sizeof(buf));
+}
+
+uint64_t readU64(std::istream& in) {
+  uint8_t buf[sizeof(uint64_t)] = {0};
+  in.read(reinterpret_cast<char*>(buf), sizeof(buf));
+  return detail::getLE(buf, sizeof(buf));
+}
+
+// Number of bytes left in the stream, or -1 if the stream is not seekable
+int64_t remainingBytes(std::istream& in) {
+  auto buf = in.rdbuf();
+  auto cur = buf->pubseekoff(0, std::ios::cur, std::ios::in);
+  if (cur == std::streampos(-1))
+    return -1;
+  auto end = buf->pubseekoff(0, std::ios::end, std::ios::in);
+  buf->pubseekpos(cur, std::ios::in);
+  return end == std::streampos(-1) ? -1 : int64_t(end - cur);
+}
+
+bool readMagic(std::istream& in) {
+  char magic[sizeof(indexMagic)];
+  in.read(magic, sizeof(magic));
+  return in.good() && std::equal(magic, magic + sizeof(magic), indexMagic);
+}
+
+void writeIndex(
+    std::ostream& out,
+    uint64_t indexOffset,
+    uint64_t tailOffset,
+    const std::vector<uint64_t>& offsets) {
+  out.write(indexMagic, sizeof(indexMagic));
+  writeU64(out, tailOffset);
+  writeU64(out, offsets.size());
+  for (auto off : offsets) {
+    writeU64(out, off);
+  }
+  writeU64(out, indexOffset);
+  out.write(indexMagic, sizeof(indexMagic));
+}
+
+void readIndex(
+    std::istream& in,
+    uint64_t& tailOffset,
+    std::vector<uint64_t>& offsets) {
+  if (!readMagic(in))
+    throw std::runtime_error("Corrupted replay: invalid keyframe index");
+  tailOffset = readU64(in);
+  auto n = readU64(in);
+  offsets.clear();
+  for (uint64_t i = 0; i < n && in.good(); i++) {
+    offsets.push_back(readU64(in));
+  }
+  readU64(in); // indexOffset
+  if (!readMagic(in))
+    throw std::runtime_error("Corrupted replay: truncated keyframe index");
+}
+
+// Reads the keyframe index of a seekable stream starting at offset 0.
+// Returns false if the replay was written without an index.
+bool readIndexFromEnd(
+    std::istream& in,
+    uint64_t& tailOffset,
+    std::vector<uint64_t>& offsets) {
+  auto pos = in.tellg();
+  in.seekg(0, std::ios::end);
+  if (!in.good() || uint64_t(in.tellg()) < indexFooterSize) {
+    in.clear();
+    in.seekg(pos);
+    return false;
+  }
+  in.seekg(-std::streamoff(indexFooterSize), std::ios::end);
+  auto indexOffset = readU64(in);
+  if (!readMagic(in)) {
+    in.clear();
+    in.seekg(pos);
+    return false;
+  }
+  in.seekg(indexOffset);
+  readIndex(in, tailOffset, offsets);
+  in.seekg(pos);
+  return true;
+}
+
+// Frames are prefixed with their size, see streaming_flatbuffers.h
+// Read-only stream buffer over an existing block of memory
+struct membuf : std::streambuf {
+  membuf(char* data, size_t size) {
+    setg(data, data, data + size);
+  }
+};
+
+void skipFrame(std::istream& in) {
+  size_t size;
+  in.read(reinterpret_cast<char*>(&size), sizeof(size));
+  in.seekg(size, std::ios::cur);
+}
+
+// Consecutive frames [begin, end) read from a replay, starting with a
+// keyframe. If dsize is non-zero, data is a Zstd frame that decompresses to
+// dsize bytes; otherwise it holds the size-prefixed frames as is.
+struct Batch {
+  size_t begin, end;
+  std::string data;
+  size_t dsize;
+};
+
+// Calls consume() on each batch obtained from produce() using numThreads
+// workers, while at most two batches per worker are buffered. produce()
+// returns false once there are no more batches. The first exception thrown
+// by either function is rethrown once all workers are done.
+template <typename Produce, typename Consume>
+void processBatches(size_t numThreads, Produce produce, Consume consume) {
+  const size_t maxQueued = 2 * numThreads;
+  std::deque<Batch> queue;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  std::exception_ptr error;
+
+  auto work = [&]() {
+    while (true) {
+      Batch batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !queue.empty() || done; });
+        if (queue.empty())
+          return;
+        batch = std::move(queue.front());
+        queue.pop_front();
+      }
+      cv.notify_all();
+      try {
+        consume(batch);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < numThreads; i++) {
+    workers.emplace_back(work);
   }
 
-  out << o.numUnits.size() << " ";
-  for (const auto& nu : o.numUnits) {
-    out << nu.first << " " << nu.second << " ";
+  try {
+    Batch batch;
+    while (produce(batch)) {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return queue.size() < maxQueued || error; });
+      if (error)
+        break;
+      queue.push_back(std::move(batch));
+      lock.unlock();
+      cv.notify_all();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error)
+      error = std::current_exception();
   }
 
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  cv.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+size_t readFrameCount(std::istream& in, const ReplayHeader& header) {
+  size_t n = 0;
+  if (header.binary()) {
+    n = readU64(in);
+  } else {
+    in >> n;
+    in.ignore(1); // Ignores next space
+  }
+  if (!in.good())
+    throw std::runtime_error("Corrupted replay: cannot read frame count");
+  return n;
+}
+
+void appendU32(std::string& out, uint32_t v) {
+  uint8_t buf[sizeof(v)];
+  detail::putLE(buf, v, sizeof(v));
+  out.append(reinterpret_cast<const char*>(buf), sizeof(buf));
+}
+
+std::string encodeNumUnits(
+    const std::unordered_map<int32_t, int32_t>& numUnits) {
+  std::string tail;
+  appendU32(tail, numUnits.size());
+  for (const auto& nu : numUnits) {
+    appendU32(tail, nu.first);
+    appendU32(tail, nu.second);
+  }
+  return tail;
+}
+
+std::string encodeHeader(const ReplayHeader& header, const Map& map) {
+  std::string out(ReplayHeader::size, '\0');
+  header.encode(reinterpret_cast<uint8_t*>(&out[0]));
+  out.append(map.data.begin(), map.data.end());
   return out;
 }
 
-std::istream& operator>>(std::istream& in, Replayer& o) {
-  // WARNING: cases were observed where this operator left a Replayer
-  // that was in a corrupted state, and would produce a segfault
-  // if we tried to delete it.
-  // Cause: invalid data file? I/O error? or a bug in the code?
+void readReplayHeader(
+    std::istream& in,
+    uint32_t& keyframe,
+    Map& map,
+    ReplayHeader& header) {
+  if (in.peek() == detail::replayMagic[0]) {
+    uint8_t buf[ReplayHeader::size];
+    in.read(reinterpret_cast<char*>(buf), sizeof(buf));
+    if (in.gcount() != std::streamsize(sizeof(buf)))
+      throw std::runtime_error("Corrupted replay: truncated header");
+    header.decode(buf);
+
+    // Reject truncated files before allocating anything, if possible: every
+    // frame takes at least its size prefix, the tail at least its count.
+    auto remaining = remainingBytes(in);
+    uint64_t mapSize = uint64_t(header.height) * header.width;
+    uint64_t minFrames = header.streamed() ? 1 : header.numFrames;
+    if (remaining >= 0 &&
+        (minFrames > uint64_t(remaining) / sizeof(size_t) ||
+         uint64_t(remaining) <
+             mapSize + minFrames * sizeof(size_t) + sizeof(uint32_t)))
+      throw std::runtime_error("Corrupted replay: truncated file");
+
+    keyframe = header.keyframe;
+    map.height = header.height;
+    map.width = header.width;
+    map.data.resize(mapSize);
+    in.read((char*)map.data.data(), mapSize);
+    if (!in.good())
+      throw std::runtime_error("Corrupted replay: truncated map data");
+    if (header.streamed())
+      header.numFrames = unknownFrames;
+    return;
+  }
 
   int32_t diffed;
   int32_t height, width;
   in >> diffed;
 
-  if (diffed == 0)
-    in >> o.keyframe >> height >> width;
+  header.version = 0;
+  header.flags = diffed == -1 ? ReplayHeader::Streamed : 0;
+  if (diffed == 0 || header.streamed())
+    in >> keyframe >> height >> width;
   else {
     height = diffed;
     in >> width;
-    o.keyframe = 0;
+    keyframe = 0;
   }
-  diffed = (diffed == 0); // Every kf is a Frame, others are frame diffs
   if (height <= 0 || width <= 0 || height > 10000 || width > 10000)
     throw std::runtime_error("Corrupted replay: invalid map size");
-  uint8_t* data = (uint8_t*)malloc(sizeof(uint8_t) * height * width);
+  map.data.resize(height * width);
+  map.height = height;
+  map.width = width;
   in.ignore(1); // Ignores next space
-  in.read((char*)data, height * width); // Read some raw bytes
-  o.setRawMap(height, width, data);
+  in.read((char*)map.data.data(), height * width); // Read some raw bytes
+  header.keyframe = keyframe;
+  header.height = height;
+  header.width = width;
+  if (header.streamed()) {
+    header.numFrames = unknownFrames;
+    return;
+  }
   size_t nFrames;
   in >> nFrames;
-  o.frames.resize(nFrames);
   in.ignore(1); // Ignores next space
-  for (size_t i = 0; i < nFrames; i++) {
-    if (o.keyframe == 0) {
-      o.frames[i] = new Frame();
-      in >> *o.frames[i];
-    } else {
-      if (i % o.keyframe == 0) {
-        o.frames[i] = new Frame();
-        in >> *o.frames[i];
-      } else {
-        FrameDiff du;
-        in >> du;
-        o.frames[i] = frame_undiff(&du, o.frames[i - 1]);
-      }
+  header.numFrames = nFrames;
+}
+
+void readNumUnitsTable(
+    std::istream& in,
+    const ReplayHeader& header,
+    std::unordered_map<int32_t, int32_t>& numUnits) {
+  if (header.binary()) {
+    uint8_t buf[2 * sizeof(uint32_t)];
+    in.read(reinterpret_cast<char*>(buf), sizeof(uint32_t));
+    auto s = detail::getLE(buf, sizeof(uint32_t));
+    if (!in.good() || s > uint64_t(remainingBytes(in)) / sizeof(buf))
+      throw std::runtime_error("Corrupted replay: truncated numUnits table");
+    for (uint64_t i = 0; i < s; i++) {
+      in.read(reinterpret_cast<char*>(buf), sizeof(buf));
+      auto key = int32_t(detail::getLE(buf, sizeof(uint32_t)));
+      numUnits[key] = int32_t(detail::getLE(buf + 4, sizeof(uint32_t)));
     }
+    if (!in.good())
+      throw std::runtime_error("Corrupted replay: truncated numUnits table");
+    return;
   }
 
   int s;
@@ -97,12 +373,535 @@ std::istream& operator>>(std::istream& in, Replayer& o) {
   int32_t key, val;
   for (auto i = 0; i < s; i++) {
     in >> key >> val;
-    o.numUnits[key] = val;
+    numUnits[key] = val;
   }
+  in.ignore(1); // Ignores next space
+}
 
+bool isCompressed(std::istream& in) {
+  uint8_t magic[sizeof(zstdMagic)];
+  in.read(reinterpret_cast<char*>(magic), sizeof(magic));
+  bool compressed =
+      in.good() && std::equal(magic, magic + sizeof(magic), zstdMagic);
+  in.clear();
+  in.seekg(0);
+  return compressed;
+}
+
+// Opens a replay file, decompressing it if needed. Compressed replays written
+// by Replayer::save() or ReplayWriter are seekable; chunks then receives the
+// (compressed, decompressed) sizes of their Zstd frames. Older compressed
+// replays can only be read sequentially, which is reported in seekable.
+std::unique_ptr<std::istream> openReplay(
+    const std::string& path,
+    std::vector<std::pair<uint64_t, uint64_t>>& chunks,
+    bool& seekable) {
+  std::unique_ptr<std::istream> in(
+      new std::ifstream(path, std::ios::in | std::ios::binary));
+  if (!in->good())
+    throw std::runtime_error("Cannot open file to load replay");
+  seekable = true;
+  chunks.clear();
+  if (isCompressed(*in)) {
+#ifdef WITH_ZSTD
+    std::vector<zstd::seek_entry> entries;
+    if (zstd::readSeekTable(in->rdbuf(), entries)) {
+      for (auto const& e : entries) {
+        chunks.emplace_back(e.compressed, e.decompressed);
+      }
+      in.reset(new zstd::seekable_ifstream(path));
+    } else {
+      in.reset(new zstd::ifstream(path));
+      seekable = false;
+    }
+#else
+    throw std::runtime_error("Cannot load compressed replay: no Zstd support");
+#endif
+  }
   return in;
 }
 
+// Like operator>>, but only decodes the given FrameFields
+template <typename T, typename Table>
+void readProjected(std::istream& in, T& frame, uint32_t fields) {
+  readFlatBufferTableFromStream<Table>(
+      in, [&frame, fields](const Table& table) {
+        frame.readFromFlatBufferTable(table, fields);
+      });
+}
+
+} // namespace
+
+std::ostream& operator<<(std::ostream& out, const Replayer& o) {
+  // Byte offsets for the keyframe index are counted by hand since
+  // compressed streams don't support tellp().
+  uint64_t pos = 0;
+  auto writeText = [&out, &pos](const std::string& text) {
+    out.write(text.data(), text.size());
+    pos += text.size();
+  };
+
+  ReplayHeader header;
+  header.keyframe = o.keyframe;
+  header.height = o.map.height;
+  header.width = o.map.width;
+  header.numFrames = o.frames.size();
+  writeText(encodeHeader(header, o.map));
+
+  // Frames are decoded on access for lazily loaded replays
+  auto& r = const_cast<Replayer&>(o);
+  auto kf = o.keyframe == 0 ? 1 : o.keyframe;
+  // Flushing a compressed stream ends the current Zstd frame. Flushes are
+  // placed on keyframe boundaries so that every frame in between holds whole
+  // segments and can be decompressed and decoded on its own.
+  out.flush();
+  size_t lastFlush = 0;
+  std::vector<uint64_t> offsets;
+  Frame* prev = nullptr;
+  FrameDiff diff;
+  for (size_t i = 0; i < o.frames.size(); i++) {
+    if (i % kf == 0 && i - lastFlush >= minChunkFrames) {
+      out.flush();
+      lastFlush = i;
+    }
+    flatbuffers::FlatBufferBuilder builder;
+    if (i % kf == 0) {
+      offsets.push_back(pos);
+      auto frame = r.getFrame(i);
+      frame->addToFlatBufferBuilder(builder);
+      if (prev)
+        prev->decref();
+      prev = frame;
+      prev->incref();
+    } else if (o.diffKeyframe == kf) {
+      // Compact replays already hold the diffs we need
+      o.diffs[i]->addToFlatBufferBuilder(builder);
+    } else {
+      auto frame = r.getFrame(i);
+      frame_diff(diff, frame, prev, o.predictive);
+      diff.addToFlatBufferBuilder(builder);
+      prev->decref();
+      prev = frame;
+      prev->incref();
+    }
+    writeFlatBufferToStream(out, builder);
+    pos += sizeof(size_t) + builder.GetSize();
+  }
+  if (prev)
+    prev->decref();
+  out.flush();
+
+  auto tailOffset = pos;
+  writeText(encodeNumUnits(o.numUnits));
+
+  writeIndex(out, pos, tailOffset, offsets);
+  return out;
+}
+
+void Replayer::readHeader(std::istream& in, ReplayHeader& header) {
+  diffs.clear();
+  diffKeyframe = 0;
+  lru.clear();
+  lruPos.clear();
+  readReplayHeader(in, keyframe, map, header);
+}
+
+void Replayer::readNumUnits(std::istream& in, const ReplayHeader& header) {
+  readNumUnitsTable(in, header, numUnits);
+}
+
+std::istream& operator>>(std::istream& in, Replayer& o) {
+  // WARNING: cases were observed where this operator left a Replayer
+  // that was in a corrupted state, and would produce a segfault
+  // if we tried to delete it.
+  // Cause: invalid data file? I/O error? or a bug in the code?
+
+  ReplayHeader header;
+  o.readHeader(in, header);
+  o.readFrames(in, header.numFrames, 1);
+  if (header.streamed() && readFrameCount(in, header) != o.frames.size())
+    throw std::runtime_error("Corrupted replay: frame count mismatch");
+  o.readNumUnits(in, header);
+
+  // The keyframe index is only needed for lazy loading
+  if (in.peek() == indexMagic[0]) {
+    uint64_t tailOffset;
+    std::vector<uint64_t> offsets;
+    readIndex(in, tailOffset, offsets);
+  }
+
+  return in;
+}
+
+void Replayer::decodeFrames(std::istream& in, size_t begin, size_t end) {
+  auto kf = keyframe == 0 ? 1 : keyframe;
+  for (size_t i = begin; i < end; i++) {
+    if (i % kf == 0) {
+      frames[i] = new Frame();
+      readProjected<Frame, fbs::Frame>(in, *frames[i], fields);
+    } else {
+      FrameDiff du;
+      readProjected<FrameDiff, fbs::FrameDiff>(in, du, fields);
+      frames[i] = frame_undiff(&du, frames[i - 1]);
+    }
+  }
+}
+
+void Replayer::readFrames(
+    std::istream& in,
+    size_t nFrames,
+    size_t numThreads,
+    bool terminated) {
+  if (nFrames == unknownFrames) {
+    // Read frames one by one until the terminating empty frame
+    frames.clear();
+    std::string data;
+    while (true) {
+      size_t size;
+      in.read(reinterpret_cast<char*>(&size), sizeof(size));
+      if (!in.good())
+        throw std::runtime_error("Corrupted replay: cannot read frame");
+      if (size == 0)
+        break;
+      data.resize(sizeof(size) + size);
+      std::memcpy(&data[0], &size, sizeof(size));
+      in.read(&data[sizeof(size)], size);
+      membuf buf(&data[0], data.size());
+      std::istream is(&buf);
+      frames.push_back(nullptr);
+      decodeFrames(is, frames.size() - 1, frames.size());
+    }
+    return;
+  }
+
+  frames.resize(nFrames);
+  auto kf = keyframe == 0 ? 1 : keyframe;
+  if (numThreads <= 1 || nFrames <= kf) {
+    decodeFrames(in, 0, nFrames);
+  } else {
+    readFramesConcurrently(in, nFrames, numThreads);
+  }
+  if (terminated) {
+    size_t size = 1;
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (size != 0)
+      throw std::runtime_error("Corrupted replay: frame count mismatch");
+  }
+}
+
+void Replayer::readFramesConcurrently(
+    std::istream& in,
+    size_t nFrames,
+    size_t numThreads) {
+  auto kf = keyframe == 0 ? 1 : keyframe;
+
+  // Keyframe segments are independent. The raw bytes of a batch of segments
+  // are read here, in order, and decoded by a pool of workers.
+  size_t i = 0;
+  auto produce = [&](Batch& batch) {
+    if (i >= nFrames)
+      return false;
+    batch = Batch{i, i, std::string(), 0};
+    for (; i < nFrames; i++) {
+      // Copy the size-prefixed frame as is
+      size_t size;
+      in.read(reinterpret_cast<char*>(&size), sizeof(size));
+      if (!in.good())
+        throw std::runtime_error("Corrupted replay: cannot read frame");
+      auto pos = batch.data.size();
+      batch.data.resize(pos + sizeof(size) + size);
+      std::memcpy(&batch.data[pos], &size, sizeof(size));
+      in.read(&batch.data[pos + sizeof(size)], size);
+      batch.end = i + 1;
+      if (batch.end % kf == 0 && batch.end - batch.begin >= minChunkFrames) {
+        i++;
+        break;
+      }
+    }
+    return true;
+  };
+  auto consume = [this](Batch& batch) {
+    membuf buf(&batch.data[0], batch.data.size());
+    std::istream is(&buf);
+    decodeFrames(is, batch.begin, batch.end);
+  };
+  processBatches(numThreads, produce, consume);
+}
+
+bool Replayer::readChunks(
+    std::istream& raw,
+    const std::vector<std::pair<uint64_t, uint64_t>>& chunks,
+    const std::vector<uint64_t>& offsets,
+    uint64_t tailOffset,
+    size_t nFrames,
+    size_t numThreads) {
+#ifdef WITH_ZSTD
+  // Map chunks to frames: chunks holding frames need to start on a keyframe,
+  // which is the case for replays written by save(). Chunks before the first
+  // keyframe or after the last frame are skipped.
+  struct Location {
+    uint64_t offset, size;
+  };
+  auto kf = keyframe == 0 ? 1 : keyframe;
+  if (offsets.size() != (nFrames + kf - 1) / kf)
+    return false;
+  std::vector<Batch> batches;
+  std::vector<Location> locations;
+  uint64_t coffset = 0, doffset = 0;
+  for (auto const& chunk : chunks) {
+    if (doffset >= tailOffset)
+      break;
+    if (chunk.second > 0) {
+      size_t seg = std::lower_bound(offsets.begin(), offsets.end(), doffset) -
+          offsets.begin();
+      if (seg < offsets.size() && offsets[seg] == doffset) {
+        if (!batches.empty())
+          batches.back().end = seg * kf;
+        batches.push_back(
+            Batch{seg * kf, nFrames, std::string(), chunk.second});
+        locations.push_back(Location{coffset, chunk.first});
+      } else if (seg > 0) {
+        return false;
+      }
+    }
+    coffset += chunk.first;
+    doffset += chunk.second;
+  }
+  if (batches.empty() || batches.front().begin != 0)
+    return false;
+
+  frames.resize(nFrames);
+  size_t next = 0;
+  auto produce = [&](Batch& batch) {
+    if (next >= batches.size())
+      return false;
+    batch = std::move(batches[next]);
+    batch.data.resize(locations[next].size);
+    raw.seekg(locations[next].offset);
+    raw.read(&batch.data[0], batch.data.size());
+    if (!raw.good())
+      throw std::runtime_error("Corrupted replay: cannot read chunk");
+    next++;
+    return true;
+  };
+  auto consume = [this](Batch& batch) {
+    std::vector<char> data(batch.dsize);
+    zstd::decompressFrame(
+        batch.data.data(), batch.data.size(), data.data(), data.size());
+    membuf buf(data.data(), data.size());
+    std::istream is(&buf);
+    decodeFrames(is, batch.begin, batch.end);
+  };
+  processBatches(numThreads, produce, consume);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Replayer::push(Frame* f) {
+  if (!isCompact()) {
+    frames.push_back(new Frame(f));
+    return;
+  }
+  if (frames.size() % diffKeyframe == 0) {
+    frames.push_back(new Frame(f));
+    diffs.emplace_back();
+    return;
+  }
+  auto prev = getFrame(frames.size() - 1);
+  diffs.emplace_back(new FrameDiff(frame_diff(f, prev)));
+  frames.push_back(nullptr);
+}
+
+void Replayer::compact() {
+  if (isLazy())
+    throw std::runtime_error("Cannot compact a lazily loaded replay");
+  if (isCompact() || keyframe <= 1)
+    return;
+
+  diffs.clear();
+  diffs.resize(frames.size());
+  for (size_t i = 1; i < frames.size(); i++) {
+    if (i % keyframe != 0) {
+      diffs[i].reset(new FrameDiff(frame_diff(frames[i], frames[i - 1])));
+    }
+    // The previous frame is no longer needed as a base for diffing
+    if ((i - 1) % keyframe != 0) {
+      frames[i - 1]->decref();
+      frames[i - 1] = nullptr;
+    }
+  }
+  if (!frames.empty() && (frames.size() - 1) % keyframe != 0) {
+    frames.back()->decref();
+    frames.back() = nullptr;
+  }
+  diffKeyframe = keyframe;
+}
+
+// Lazy loading and compact mode
+
+void Replayer::touchFrame(size_t i) {
+  if (frames[i] == nullptr) {
+    if (source) {
+      readSegment(i);
+    } else {
+      rebuildFrame(i);
+    }
+  } else {
+    lru.splice(lru.begin(), lru, lruPos[i]);
+  }
+
+  while (lru.size() > cacheSize) {
+    auto j = lru.back();
+    lru.pop_back();
+    lruPos.erase(j);
+    frames[j]->decref();
+    frames[j] = nullptr;
+  }
+}
+
+void Replayer::readSegment(size_t i) {
+  // Decode from the closest keyframe, re-using frames that are still
+  // resident as bases for the following diffs.
+  auto kf = sourceKeyframe == 0 ? 1 : sourceKeyframe;
+  auto segment = i / kf;
+  auto& in = *source;
+  in.clear();
+  in.seekg(segmentOffsets[segment]);
+  for (size_t j = segment * kf; j <= i; j++) {
+    if (frames[j] != nullptr) {
+      skipFrame(in);
+      lru.splice(lru.begin(), lru, lruPos[j]);
+      continue;
+    }
+    // Frames only become resident once decoded, corrupted ones throw
+    auto f = framePool.get();
+    try {
+      if (j % kf == 0) {
+        readProjected<Frame, fbs::Frame>(in, *f, fields);
+      } else {
+        FrameDiff du;
+        readProjected<FrameDiff, fbs::FrameDiff>(in, du, fields);
+        frame_undiff(f, &du, frames[j - 1]);
+      }
+    } catch (...) {
+      f->decref();
+      throw;
+    }
+    frames[j] = f;
+    lru.push_front(j);
+    lruPos[j] = lru.begin();
+  }
+  if (!in.good())
+    throw std::runtime_error("Corrupted replay: cannot read frame");
+}
+
+void Replayer::rebuildFrame(size_t i) {
+  // Apply diffs starting from the closest resident frame; keyframes are
+  // always resident in compact mode.
+  size_t j = i;
+  while (frames[j] == nullptr) {
+    j--;
+  }
+  if (diffs[j]) {
+    lru.splice(lru.begin(), lru, lruPos[j]);
+  }
+  for (j++; j <= i; j++) {
+    auto f = framePool.get();
+    try {
+      frame_undiff(f, diffs[j].get(), frames[j - 1]);
+    } catch (...) {
+      f->decref();
+      throw;
+    }
+    frames[j] = f;
+    lru.push_front(j);
+    lruPos[j] = lru.begin();
+  }
+}
+
+void UnitColumns::reserve(size_t n) {
+  for (auto v : {&frame,
+                 &playerId,
+                 &id,
+                 &type,
+                 &x,
+                 &y,
+                 &pixel_x,
+                 &pixel_y,
+                 &health,
+                 &max_health,
+                 &shield,
+                 &max_shield,
+                 &energy,
+                 &groundCD,
+                 &airCD,
+                 &visible,
+                 &resources}) {
+    v->reserve(n);
+  }
+  flags.reserve(n);
+  velocityX.reserve(n);
+  velocityY.reserve(n);
+}
+
+void UnitColumns::push(int32_t f, const Unit& u) {
+  frame.push_back(f);
+  playerId.push_back(u.playerId);
+  id.push_back(u.id);
+  type.push_back(u.type);
+  x.push_back(u.x);
+  y.push_back(u.y);
+  pixel_x.push_back(u.pixel_x);
+  pixel_y.push_back(u.pixel_y);
+  health.push_back(u.health);
+  max_health.push_back(u.max_health);
+  shield.push_back(u.shield);
+  max_shield.push_back(u.max_shield);
+  energy.push_back(u.energy);
+  groundCD.push_back(u.groundCD);
+  airCD.push_back(u.airCD);
+  visible.push_back(u.visible);
+  resources.push_back(u.resources);
+  flags.push_back(u.flags);
+  velocityX.push_back(u.velocityX);
+  velocityY.push_back(u.velocityY);
+}
+
+UnitColumns Replayer::getUnitColumns() {
+  UnitColumns cols;
+  cols.frameOffsets.reserve(frames.size() + 1);
+  cols.frameOffsets.push_back(0);
+  if (!isLazy() && !isCompact()) {
+    // Frames are resident, so sizing the columns upfront is cheap
+    size_t n = 0;
+    for (auto f : frames) {
+      for (auto& p : f->units) {
+        n += p.second.size();
+      }
+    }
+    cols.reserve(n);
+  }
+
+  std::vector<int32_t> players;
+  for (size_t i = 0; i < frames.size(); i++) {
+    auto f = getFrame(i);
+    players.clear();
+    for (auto& p : f->units) {
+      players.push_back(p.first);
+    }
+    std::sort(players.begin(), players.end());
+    for (auto pid : players) {
+      for (auto& u : f->units[pid]) {
+        cols.push(i, u);
+      }
+    }
+    cols.frameOffsets.push_back(cols.size());
+  }
+  return cols;
+}
+
 void Replayer::setMap(
     int32_t h,
     int32_t w,
@@ -204,16 +1003,88 @@ std::pair<int32_t, int32_t> Replayer::getMap(
   return std::make_pair(h, w);
 }
 
-void Replayer::load(const std::string& path) {
-#ifdef WITH_ZSTD
-  zstd::ifstream in(path);
-#else
-  std::ifstream in(path);
-#endif
-  if (!in.good())
-    throw std::runtime_error("Cannot open file to load replay");
-  in >> *this;
-  in.close();
+void Replayer::load(const std::string& path, bool lazy, size_t numThreads) {
+  std::vector<std::pair<uint64_t, uint64_t>> chunks;
+  bool seekable;
+  auto in = openReplay(path, chunks, seekable);
+  if (lazy && seekable) {
+    loadLazy(std::move(in));
+    return;
+  }
+
+  source.reset();
+  ReplayHeader header;
+  readHeader(*in, header);
+  size_t nFrames = header.numFrames;
+  bool streamed = header.streamed();
+  uint64_t tailOffset;
+  std::vector<uint64_t> offsets;
+  if (numThreads > 1 && (streamed || !chunks.empty()) &&
+      readIndexFromEnd(*in, tailOffset, offsets)) {
+    if (streamed) {
+      // The frame count is needed upfront for concurrent decoding
+      auto pos = in->tellg();
+      in->seekg(tailOffset);
+      nFrames = readFrameCount(*in, header);
+      in->seekg(pos);
+    }
+    std::ifstream raw(path, std::ios::in | std::ios::binary);
+    if (!chunks.empty() &&
+        readChunks(raw, chunks, offsets, tailOffset, nFrames, numThreads)) {
+      in->seekg(tailOffset);
+      if (streamed)
+        readFrameCount(*in, header);
+      readNumUnits(*in, header);
+      return;
+    }
+  }
+  readFrames(*in, nFrames, numThreads, streamed);
+  if (streamed && readFrameCount(*in, header) != frames.size())
+    throw std::runtime_error("Corrupted replay: frame count mismatch");
+  readNumUnits(*in, header);
+}
+
+void Replayer::loadLazy(std::unique_ptr<std::istream> in) {
+  ReplayHeader header;
+  readHeader(*in, header);
+  size_t nFrames = header.numFrames;
+  auto kf = keyframe == 0 ? 1 : keyframe;
+
+  bool streamed = header.streamed();
+  uint64_t tailOffset;
+  segmentOffsets.clear();
+  if (!readIndexFromEnd(*in, tailOffset, segmentOffsets)) {
+    // Written before replays had an index: locate keyframes by skipping over
+    // the size-prefixed frames.
+    for (size_t i = 0; i < nFrames && in->good(); i++) {
+      auto pos = in->tellg();
+      size_t size;
+      in->read(reinterpret_cast<char*>(&size), sizeof(size));
+      if (streamed && size == 0)
+        break;
+      if (i % kf == 0)
+        segmentOffsets.push_back(pos);
+      in->seekg(size, std::ios::cur);
+    }
+    tailOffset = in->tellg();
+  }
+  in->seekg(tailOffset);
+  if (streamed)
+    nFrames = readFrameCount(*in, header);
+  if (!in->good() || segmentOffsets.size() != (nFrames + kf - 1) / kf)
+    throw std::runtime_error("Corrupted replay: invalid keyframe index");
+  readNumUnits(*in, header);
+
+  for (auto f : frames) {
+    if (f)
+      f->decref();
+  }
+  frames.assign(nFrames, nullptr);
+  lru.clear();
+  lruPos.clear();
+  sourceKeyframe = keyframe;
+  numSourceFrames = nFrames;
+  source = std::move(in);
 }
 
 void Replayer::save(const std::string& path, bool compressed) {
@@ -227,14 +1098,14 @@ void Replayer::save(const std::string& path, bool compressed) {
 
   if (compressed) {
 #ifdef WITH_ZSTD
-    zstd::ofstream out(path);
+    zstd::ofstream out(path, std::ios::out, true);
     if (!out.good())
       throw std::runtime_error("Cannot open file to save replay");
     out << *this;
     out.close();
 #endif
   } else {
-    std::ofstream out(path);
+    std::ofstream out(path, std::ios::out | std::ios::binary);
     if (!out.good())
       throw std::runtime_error("Cannot open file to save replay");
     out << *this;
@@ -242,5 +1113,212 @@ void Replayer::save(const std::string& path, bool compressed) {
   }
 }
 
+// ReplayWriter
+
+ReplayWriter::ReplayWriter(
+    const std::string& path,
+    uint32_t keyframe,
+    bool compressed)
+    : keyframe_(keyframe) {
+  map_.height = map_.width = 0;
+#ifndef WITH_ZSTD
+  if (compressed) {
+    std::cerr << "Warning: no Zstd support; disabling "
+              << "compression for saved replay" << std::endl;
+    compressed = false;
+  }
+#endif
+
+  if (compressed) {
+#ifdef WITH_ZSTD
+    out_.reset(new zstd::ofstream(path, std::ios::out, true));
+#endif
+  } else {
+    out_.reset(new std::ofstream(path, std::ios::out | std::ios::binary));
+  }
+  if (!out_->good()) {
+    out_.reset();
+    throw std::runtime_error("Cannot open file to save replay");
+  }
+}
+
+ReplayWriter::~ReplayWriter() {
+  try {
+    close();
+  } catch (std::exception& e) {
+    std::cerr << "Error while closing replay: " << e.what() << std::endl;
+  }
+}
+
+void ReplayWriter::setMapFromState(torchcraft::State const* state) {
+  Replayer rep;
+  rep.setMapFromState(state);
+  setRawMap(rep.mapHeight(), rep.mapWidth(), rep.getRawMap().data());
+}
+
+void ReplayWriter::setRawMap(uint32_t h, uint32_t w, uint8_t const* d) {
+  if (headerWritten_)
+    throw std::runtime_error("Cannot set map after frames have been written");
+  map_.data.assign(d, d + h * w);
+  map_.height = h;
+  map_.width = w;
+}
+
+void ReplayWriter::write(const std::string& data) {
+  out_->write(data.data(), data.size());
+  pos_ += data.size();
+}
+
+void ReplayWriter::writeHeader() {
+  ReplayHeader header;
+  header.flags = ReplayHeader::Streamed;
+  header.keyframe = keyframe_;
+  header.height = map_.height;
+  header.width = map_.width;
+  write(encodeHeader(header, map_));
+  out_->flush(); // Ends the first chunk, see operator<<
+  headerWritten_ = true;
+}
+
+void ReplayWriter::push(Frame* f) {
+  if (!out_)
+    throw std::runtime_error("Cannot push frame to closed replay");
+  if (!headerWritten_)
+    writeHeader();
+
+  auto kf = keyframe_ == 0 ? 1 : keyframe_;
+  auto i = numFrames_;
+  if (i % kf == 0 && i - lastFlush_ >= minChunkFrames) {
+    // Also makes sure that data hits the disk regularly
+    out_->flush();
+    lastFlush_ = i;
+  }
+  flatbuffers::FlatBufferBuilder builder;
+  if (i % kf == 0) {
+    offsets_.push_back(pos_);
+    f->addToFlatBufferBuilder(builder);
+  } else {
+    frame_diff(diff_, f, &prev_, predictive_);
+    diff_.addToFlatBufferBuilder(builder);
+  }
+  writeFlatBufferToStream(*out_, builder);
+  pos_ += sizeof(size_t) + builder.GetSize();
+  if (!out_->good())
+    throw std::runtime_error("Cannot write replay frame");
+
+  for (const auto& u : f->units) {
+    auto s = static_cast<int32_t>(u.second.size());
+    auto it = numUnits_.find(u.first);
+    if (it == numUnits_.end()) {
+      numUnits_[u.first] = s;
+    } else if (s > it->second) {
+      it->second = s;
+    }
+  }
+  if (kf > 1) // Only needed for diffing
+    prev_ = *f;
+  numFrames_++;
+}
+
+void ReplayWriter::close() {
+  if (!out_)
+    return;
+  if (!headerWritten_)
+    writeHeader();
+
+  size_t end = 0;
+  out_->write(reinterpret_cast<const char*>(&end), sizeof(end));
+  pos_ += sizeof(end);
+  out_->flush();
+
+  auto tailOffset = pos_;
+  writeU64(*out_, numFrames_);
+  pos_ += sizeof(uint64_t);
+  write(encodeNumUnits(numUnits_));
+  writeIndex(*out_, pos_, tailOffset, offsets_);
+  out_->flush();
+  bool good = out_->good();
+  out_.reset();
+  if (!good)
+    throw std::runtime_error("Cannot write replay footer");
+}
+
+// ReplayReader
+
+ReplayReader::~ReplayReader() {}
+
+ReplayReader::ReplayReader(const std::string& path, uint32_t fields)
+    : header_(new ReplayHeader()), fields_(fields) {
+  std::vector<std::pair<uint64_t, uint64_t>> chunks;
+  bool seekable;
+  in_ = openReplay(path, chunks, seekable);
+  readReplayHeader(*in_, keyframe_, map_, *header_);
+  nFrames_ = header_->numFrames;
+  streamed_ = header_->streamed();
+
+  // Fetch the trailing frame count and numUnits table right away if possible
+  uint64_t tailOffset;
+  std::vector<uint64_t> offsets;
+  if (seekable && readIndexFromEnd(*in_, tailOffset, offsets)) {
+    auto pos = in_->tellg();
+    in_->seekg(tailOffset);
+    readTail();
+    in_->seekg(pos);
+  }
+}
+
+void ReplayReader::readTail() {
+  if (streamed_) {
+    auto n = readFrameCount(*in_, *header_);
+    if (nFrames_ != unknownFrames && n != nFrames_)
+      throw std::runtime_error("Corrupted replay: frame count mismatch");
+    nFrames_ = n;
+  }
+  readNumUnitsTable(*in_, *header_, numUnits_);
+  tailRead_ = true;
+}
+
+Frame* ReplayReader::next() {
+  if (done_)
+    return nullptr;
+
+  size_t size = 0;
+  if (streamed_ || position_ < nFrames_) {
+    in_->read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!in_->good())
+      throw std::runtime_error("Corrupted replay: cannot read frame");
+  }
+  if (size == 0) { // End of frames
+    if (!tailRead_)
+      readTail();
+    if (position_ != nFrames_)
+      throw std::runtime_error("Corrupted replay: frame count mismatch");
+    done_ = true;
+    return nullptr;
+  }
+
+  buffer_.resize(size);
+  in_->read(buffer_.data(), size);
+  if (!in_->good())
+    throw std::runtime_error("Corrupted replay: cannot read frame");
+  auto data = reinterpret_cast<const uint8_t*>(buffer_.data());
+  flatbuffers::Verifier verifier(data, size);
+  auto kf = keyframe_ == 0 ? 1 : keyframe_;
+  if (position_ % kf == 0) {
+    if (!verifier.VerifyBuffer<fbs::Frame>())
+      throw std::runtime_error("Corrupted replay: invalid frame");
+    frame_.readFromFlatBufferTable(
+        *flatbuffers::GetRoot<fbs::Frame>(data), fields_);
+  } else {
+    if (!verifier.VerifyBuffer<fbs::FrameDiff>())
+      throw std::runtime_error("Corrupted replay: invalid frame");
+    diff_.readFromFlatBufferTable(
+        *flatbuffers::GetRoot<fbs::FrameDiff>(data), fields_);
+    frame_undiff(&frame_, &frame_, &diff_);
+  }
+  position_++;
+  return &frame_;
+}
+
 } // namespace replayer
 } // namespace torchcraft
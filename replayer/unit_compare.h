@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Word-wise comparison of units for frame_diff(). Unit is trivially copyable,
+ * so two units are compared as arrays of 32-bit words, which vectorizes
+ * without looking at individual fields. The implementation is picked at
+ * build time: AVX2 if enabled (-mavx2, see WITH_AVX2 in CMakeLists.txt), SSE2
+ * on all other x86-64 targets and a scalar loop otherwise.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "frame.h"
+
+namespace torchcraft {
+namespace replayer {
+namespace detail {
+
+static const size_t kUnitWords = sizeof(Unit) / sizeof(uint32_t);
+static_assert(
+    sizeof(Unit) % sizeof(uint32_t) == 0 && kUnitWords <= 64,
+    "Units must fit in a 64-bit mask of 32-bit words");
+
+// Bit i of the result is set if the i-th 32-bit words of both units differ.
+// Padding between fields is compared too, so callers should only look at
+// the words of the fields they are interested in.
+inline uint64_t changedUnitWordsScalar(const Unit& a, const Unit& b) {
+  auto pa = reinterpret_cast<const char*>(&a);
+  auto pb = reinterpret_cast<const char*>(&b);
+  uint64_t mask = 0;
+  for (size_t i = 0; i < kUnitWords; i++) {
+    uint32_t wa, wb;
+    std::memcpy(&wa, pa + 4 * i, 4);
+    std::memcpy(&wb, pb + 4 * i, 4);
+    mask |= uint64_t(wa != wb) << i;
+  }
+  return mask;
+}
+
+inline uint64_t changedUnitWords(const Unit& a, const Unit& b) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  auto pa = reinterpret_cast<const char*>(&a);
+  auto pb = reinterpret_cast<const char*>(&b);
+  uint64_t mask = 0;
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= kUnitWords; i += 8) {
+    auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa + 4 * i));
+    auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb + 4 * i));
+    auto eq = _mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb));
+    mask |= uint64_t(~_mm256_movemask_ps(eq) & 0xFF) << i;
+  }
+#endif
+  for (; i + 4 <= kUnitWords; i += 4) {
+    auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + 4 * i));
+    auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + 4 * i));
+    auto eq = _mm_castsi128_ps(_mm_cmpeq_epi32(va, vb));
+    mask |= uint64_t(~_mm_movemask_ps(eq) & 0xF) << i;
+  }
+  for (; i < kUnitWords; i++) {
+    uint32_t wa, wb;
+    std::memcpy(&wa, pa + 4 * i, 4);
+    std::memcpy(&wb, pb + 4 * i, 4);
+    mask |= uint64_t(wa != wb) << i;
+  }
+  return mask;
+#else
+  return changedUnitWordsScalar(a, b);
+#endif
+}
+
+} // namespace detail
+} // namespace replayer
+} // namespace torchcraft
@@ -12,9 +12,12 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <fstream>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 // Required to access ZSTD_isFrame()
@@ -55,7 +58,7 @@ class cstream {
  public:
   static const int defaultLevel = 5;
 
-  explicit cstream(int level = defaultLevel) : ended_(false) {
+  explicit cstream(int level = defaultLevel) : level_(level), ended_(false) {
     cstr_ = ZSTD_createCStream();
     if (cstr_ == nullptr) {
     }
@@ -80,8 +83,15 @@ class cstream {
     return ended_;
   }
 
+  // Starts a new frame after end()
+  void reset() {
+    check(ZSTD_initCStream(cstr_, level_));
+    ended_ = false;
+  }
+
  private:
   ZSTD_CStream* cstr_;
+  int level_;
   bool ended_;
 };
 
@@ -107,11 +117,110 @@ class dstream {
   ZSTD_DStream* dstr_;
 };
 
-// Zstd stream for compression. Data is written in a single big frame.
+// Seek table of the Zstd seekable format (see contrib/seekable_format in the
+// Zstd repository). It is stored in a skippable frame at the end of the file
+// and lists the compressed and decompressed sizes of all preceding frames, so
+// that readers can locate and decompress any frame independently:
+//   0x184D2A5E u32:tableSize {u32:compressed u32:decompressed}...
+//   u32:numFrames u8:descriptor 0x8F92EAB1
+// All integers are little-endian.
+struct seek_entry {
+  uint32_t compressed;
+  uint32_t decompressed;
+};
+
+namespace detail {
+const uint32_t skippableMagic = 0x184D2A5E;
+const uint32_t seekableMagic = 0x8F92EAB1;
+const size_t seekFooterSize = 9;
+
+inline void putLE32(std::string& out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back(char((v >> (8 * i)) & 0xFF));
+  }
+}
+
+inline uint32_t getLE32(const char* p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= uint32_t(uint8_t(p[i])) << (8 * i);
+  }
+  return v;
+}
+} // namespace detail
+
+inline std::string makeSeekTable(const std::vector<seek_entry>& entries) {
+  std::string table;
+  detail::putLE32(table, detail::skippableMagic);
+  detail::putLE32(table, entries.size() * 8 + detail::seekFooterSize);
+  for (const auto& e : entries) {
+    detail::putLE32(table, e.compressed);
+    detail::putLE32(table, e.decompressed);
+  }
+  detail::putLE32(table, entries.size());
+  table.push_back(0); // No checksums
+  detail::putLE32(table, detail::seekableMagic);
+  return table;
+}
+
+// Reads the seek table at the end of a seekable stream buffer. Returns false
+// if there is none. The read position of sbuf is left undefined.
+inline bool readSeekTable(std::streambuf* sbuf, std::vector<seek_entry>& out) {
+  auto size = sbuf->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+  if (size < std::streamoff(detail::seekFooterSize + 8)) {
+    return false;
+  }
+  char footer[detail::seekFooterSize];
+  sbuf->pubseekoff(-std::streamoff(sizeof(footer)), std::ios_base::end);
+  if (sbuf->sgetn(footer, sizeof(footer)) != std::streamsize(sizeof(footer)) ||
+      detail::getLE32(footer + 5) != detail::seekableMagic ||
+      (footer[4] & 0x80) != 0) {
+    return false;
+  }
+  auto n = detail::getLE32(footer);
+  // Computed in 64 bits so that huge entry counts don't wrap around
+  uint64_t frameSize = uint64_t(n) * 8 + detail::seekFooterSize;
+  std::streamoff tableSize = frameSize + 8;
+  if (tableSize > size) {
+    return false;
+  }
+  std::vector<char> table(tableSize);
+  sbuf->pubseekoff(-tableSize, std::ios_base::end);
+  if (sbuf->sgetn(table.data(), tableSize) != tableSize ||
+      detail::getLE32(table.data()) != detail::skippableMagic ||
+      detail::getLE32(table.data() + 4) != frameSize) {
+    return false;
+  }
+  out.resize(n);
+  for (uint32_t i = 0; i < n; i++) {
+    out[i].compressed = detail::getLE32(table.data() + 8 + 8 * i);
+    out[i].decompressed = detail::getLE32(table.data() + 12 + 8 * i);
+  }
+  return true;
+}
+
+// Decompresses a single, complete frame whose decompressed size is known
+inline void decompressFrame(
+    const char* src,
+    size_t srcSize,
+    char* dst,
+    size_t dstSize) {
+  if (check(ZSTD_decompress(dst, dstSize, src, srcSize)) != dstSize) {
+    throw std::runtime_error(
+        std::string("zstd: ") + "unexpected decompressed frame size");
+  }
+}
+
+// Zstd stream for compression. Each sync() (e.g. a flush() of the owning
+// stream) ends the current frame; the next write starts a new one. In
+// seekable mode, a seek table listing all frames is appended on close().
 class ostreambuf : public std::streambuf {
  public:
-  explicit ostreambuf(std::streambuf* sbuf, int level = cstream::defaultLevel)
-      : sbuf_(sbuf), str_(level) {
+  explicit ostreambuf(
+      std::streambuf* sbuf,
+      int level = cstream::defaultLevel,
+      bool seekable = false)
+      : sbuf_(sbuf), str_(level), seekable_(seekable) {
     inbuf_.resize(ZSTD_CStreamInSize());
     outbuf_.resize(ZSTD_CStreamOutSize());
     inhint_ = inbuf_.size();
@@ -119,7 +228,10 @@ class ostreambuf : public std::streambuf {
   }
 
   virtual ~ostreambuf() {
-    sync();
+    try {
+      close();
+    } catch (...) {
+    }
   }
 
   virtual int_type overflow(int_type ch = traits_type::eof()) {
@@ -134,26 +246,44 @@ class ostreambuf : public std::streambuf {
 
   virtual int sync() {
     overflow();
-    if (!pptr() || str_.ended()) {
+    if (!pptr() || closed_) {
       return -1;
     }
+    if (frameIn_ == 0) {
+      return 0; // Nothing to flush
+    }
+    return endFrame();
+  }
 
-    // Flush and finish the Zstd frame
-    ZSTD_outBuffer output = {outbuf_.data(), outbuf_.size(), 0};
-    auto ret = str_.end(&output);
-    check(ret);
-    if (ret) {
-      throw std::runtime_error(std::string("zstd: ") + "not fully flushed");
+  // Ends the last frame and writes the seek table, if any
+  int close() {
+    if (closed_) {
+      return 0;
+    }
+    overflow();
+    if (!pptr()) {
+      return -1;
     }
-    if (sbuf_->sputn(reinterpret_cast<char*>(output.dst), output.pos) !=
-        output.pos) {
+    // Always produce at least one frame, even if empty
+    if ((frameIn_ > 0 || entries_.empty()) && endFrame() != 0) {
       return -1;
     }
+    closed_ = true;
+    if (seekable_) {
+      auto table = makeSeekTable(entries_);
+      if (sbuf_->sputn(table.data(), table.size()) !=
+          std::streamsize(table.size())) {
+        return -1;
+      }
+    }
     return 0;
   }
 
  private:
   ssize_t compress(size_t pos) {
+    if (pos > 0 && str_.ended()) {
+      str_.reset();
+    }
     ZSTD_inBuffer input = {inbuf_.data(), pos, 0};
     while (input.pos != input.size) {
       ZSTD_outBuffer output = {outbuf_.data(), outbuf_.size(), 0};
@@ -161,21 +291,48 @@ class ostreambuf : public std::streambuf {
       check(ret);
       inhint_ = std::min(ret, inbuf_.size());
 
-      if (output.pos > 0 &&
-          sbuf_->sputn(reinterpret_cast<char*>(output.dst), output.pos) !=
-              output.pos) {
+      if (output.pos > 0 && !write(output)) {
         return -1;
       }
     }
+    frameIn_ += pos;
 
     return 0;
   }
 
+  int endFrame() {
+    if (str_.ended()) {
+      str_.reset();
+    }
+    size_t ret;
+    do {
+      ZSTD_outBuffer output = {outbuf_.data(), outbuf_.size(), 0};
+      ret = str_.end(&output);
+      if (!write(output)) {
+        return -1;
+      }
+    } while (ret > 0);
+    entries_.push_back({uint32_t(frameOut_), uint32_t(frameIn_)});
+    frameIn_ = frameOut_ = 0;
+    return 0;
+  }
+
+  bool write(const ZSTD_outBuffer& output) {
+    frameOut_ += output.pos;
+    return sbuf_->sputn(reinterpret_cast<char*>(output.dst), output.pos) ==
+        std::streamsize(output.pos);
+  }
+
   std::streambuf* sbuf_;
   cstream str_;
   std::vector<char> inbuf_;
   std::vector<char> outbuf_;
   size_t inhint_;
+  bool seekable_;
+  bool closed_ = false;
+  size_t frameIn_ = 0; // Bytes compressed in the current frame
+  size_t frameOut_ = 0; // Bytes output for the current frame
+  std::vector<seek_entry> entries_;
 };
 
 // Zstd stream for decompression. If input data is not compressed, this stream
@@ -217,10 +374,13 @@ class istreambuf : public std::streambuf {
         ZSTD_inBuffer input = {inbuf_.data(), inavail_, inpos_};
         ZSTD_outBuffer output = {outbuf_.data(), outbuf_.size(), 0};
         auto ret = str_.decompress(&output, &input);
-        inhint_ = std::min(ret, inbuf_.size());
+        // A return value of 0 marks the end of a frame; further frames may
+        // follow.
+        inhint_ = ret > 0 ? std::min(ret, inbuf_.size()) : inbuf_.size();
         inpos_ = input.pos;
-        if (output.pos == 0 && inhint_ > 0 && inpos_ >= inavail_) {
-          // Zstd did not decompress anything but requested more data
+        if (output.pos == 0) {
+          // Zstd did not decompress anything, e.g. because it requested more
+          // data or skipped over a skippable frame
           continue;
         }
         setg(outbuf_.data(), outbuf_.data(), outbuf_.data() + output.pos);
@@ -247,6 +407,114 @@ class istreambuf : public std::streambuf {
   bool compressed_ = false;
 };
 
+// Zstd stream for random-access decompression of files written in the
+// seekable format, i.e. with ostreambuf in seekable mode. Seeking locates the
+// frame containing the target position and decompresses it as a whole, so
+// positioning is cheap if frames are reasonably small.
+class seekable_istreambuf : public std::streambuf {
+ public:
+  explicit seekable_istreambuf(std::streambuf* sbuf) : sbuf_(sbuf) {
+    std::vector<seek_entry> entries;
+    if (!readSeekTable(sbuf_, entries)) {
+      throw std::runtime_error(std::string("zstd: ") + "missing seek table");
+    }
+    coffsets_.resize(entries.size() + 1, 0);
+    doffsets_.resize(entries.size() + 1, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+      coffsets_[i + 1] = coffsets_[i] + entries[i].compressed;
+      doffsets_[i + 1] = doffsets_[i] + entries[i].decompressed;
+    }
+  }
+
+  size_t numFrames() const {
+    return coffsets_.size() - 1;
+  }
+
+  // Decompressed offsets of all frames, followed by the total size
+  const std::vector<uint64_t>& offsets() const {
+    return doffsets_;
+  }
+
+ protected:
+  virtual int_type underflow() {
+    if (gptr() != egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    auto k = loaded_ ? chunk_ + 1 : chunk_;
+    while (k < numFrames() && doffsets_[k + 1] == doffsets_[k]) {
+      k++;
+    }
+    if (k >= numFrames()) {
+      return traits_type::eof();
+    }
+    load(k);
+    setg(outbuf_.data(), outbuf_.data(), outbuf_.data() + outbuf_.size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+  virtual pos_type seekoff(
+      off_type off,
+      std::ios_base::seekdir dir,
+      std::ios_base::openmode which = std::ios_base::in) {
+    off_type base = 0;
+    if (dir == std::ios_base::cur) {
+      base = doffsets_[chunk_] + (loaded_ ? gptr() - eback() : 0);
+    } else if (dir == std::ios_base::end) {
+      base = doffsets_.back();
+    }
+    return seekpos(base + off, which);
+  }
+
+  virtual pos_type seekpos(
+      pos_type pos,
+      std::ios_base::openmode which = std::ios_base::in) {
+    if (!(which & std::ios_base::in) || off_type(pos) < 0 ||
+        uint64_t(off_type(pos)) > doffsets_.back()) {
+      return pos_type(off_type(-1));
+    }
+    uint64_t p = off_type(pos);
+    auto k = std::upper_bound(doffsets_.begin(), doffsets_.end(), p) -
+        doffsets_.begin() - 1;
+    if (size_t(k) >= numFrames()) {
+      // End of stream
+      chunk_ = numFrames();
+      loaded_ = false;
+      setg(nullptr, nullptr, nullptr);
+      return pos;
+    }
+    if (!loaded_ || size_t(k) != chunk_) {
+      load(k);
+    }
+    setg(
+        outbuf_.data(),
+        outbuf_.data() + (p - doffsets_[k]),
+        outbuf_.data() + outbuf_.size());
+    return pos;
+  }
+
+ private:
+  void load(size_t k) {
+    auto csize = coffsets_[k + 1] - coffsets_[k];
+    inbuf_.resize(csize);
+    outbuf_.resize(doffsets_[k + 1] - doffsets_[k]);
+    sbuf_->pubseekpos(coffsets_[k], std::ios_base::in);
+    if (sbuf_->sgetn(inbuf_.data(), csize) != std::streamsize(csize)) {
+      throw std::runtime_error(std::string("zstd: ") + "truncated frame");
+    }
+    decompressFrame(inbuf_.data(), csize, outbuf_.data(), outbuf_.size());
+    chunk_ = k;
+    loaded_ = true;
+  }
+
+  std::streambuf* sbuf_;
+  std::vector<uint64_t> coffsets_;
+  std::vector<uint64_t> doffsets_;
+  std::vector<char> inbuf_;
+  std::vector<char> outbuf_;
+  size_t chunk_ = 0;
+  bool loaded_ = false;
+};
+
 // This class enables [io]fstream below to inherit from [io]stream (required for
 // setting a custom streambuf) while still constructing a corresponding
 // [io]fstream first (required for initializing the Zstd streambufs).
@@ -267,9 +535,11 @@ class ofstream : private fsholder<std::ofstream>, public std::ostream {
  public:
   explicit ofstream(
       const std::string& path,
-      std::ios_base::openmode mode = std::ios_base::out)
+      std::ios_base::openmode mode = std::ios_base::out,
+      bool seekable = false)
       : fsholder<std::ofstream>(path, mode | std::ios_base::binary),
-        std::ostream(new ostreambuf(fs_.rdbuf())) {
+        std::ostream(
+            new ostreambuf(fs_.rdbuf(), cstream::defaultLevel, seekable)) {
     exceptions(std::ios_base::badbit);
   }
 
@@ -284,7 +554,9 @@ class ofstream : private fsholder<std::ofstream>, public std::ostream {
   }
 
   void close() {
-    flush();
+    if (static_cast<ostreambuf*>(rdbuf())->close() != 0) {
+      setstate(std::ios_base::badbit);
+    }
     fs_.close();
   }
 };
@@ -315,4 +587,31 @@ class ifstream : private fsholder<std::ifstream>, public std::istream {
   }
 };
 
+// Input file stream for Zstd-compressed data in the seekable format. Throws if
+// the file does not contain a seek table.
+class seekable_ifstream : private fsholder<std::ifstream>, public std::istream {
+ public:
+  explicit seekable_ifstream(
+      const std::string& path,
+      std::ios_base::openmode mode = std::ios_base::in)
+      : fsholder<std::ifstream>(path, mode | std::ios_base::binary),
+        std::istream(new seekable_istreambuf(fs_.rdbuf())) {
+    exceptions(std::ios_base::badbit);
+  }
+
+  virtual ~seekable_ifstream() {
+    if (rdbuf()) {
+      delete rdbuf();
+    }
+  }
+
+  operator bool() const {
+    return bool(fs_);
+  }
+
+  void close() {
+    fs_.close();
+  }
+};
+
 } // namespace zstd
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Counts heap allocations and measures the time per frame_diff() call, for
+ * fresh FrameDiffs and for a FrameDiff that is re-used across calls.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "frame.h"
+
+namespace {
+std::atomic<size_t> numAllocs(0);
+}
+
+void* operator new(size_t size) {
+  numAllocs++;
+  if (auto p = std::malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+using namespace torchcraft::replayer;
+
+namespace {
+
+const int kNumFrames = 64;
+const int kNumUnits = 200;
+
+Frame* makeFrame(int t) {
+  auto f = new Frame();
+  f->width = 64;
+  f->height = 64;
+  f->reward = t;
+  f->is_terminal = 0;
+  f->creep_map.assign(f->width * f->height / 8, 0);
+  f->creep_map[t % f->creep_map.size()] = 1;
+  for (int32_t pid = 0; pid < 2; pid++) {
+    f->resources[pid] = {50 + t, 10, 4, 10, 0, 0, 0};
+    auto& units = f->units[pid];
+    for (int32_t id = 0; id < kNumUnits; id++) {
+      // Units are reported in an arbitrary order
+      Unit u = Unit();
+      u.id = 1000 * pid + (id * 7919) % kNumUnits;
+      u.x = id + t / 3;
+      u.y = id - t / 4;
+      u.health = 100 - (t + id) % 50;
+      u.type = id % 5;
+      u.playerId = pid;
+      u.flags = t % 2 ? Unit::Flags::Moving : Unit::Flags::Idle;
+      f->setOrders(u, {{t - t % 8, 1 + id % 3, -1, u.x + 1, u.y + 1}});
+      units.push_back(u);
+    }
+  }
+  return f;
+}
+
+template <typename F>
+void run(const char* name, std::vector<Frame*>& frames, int rounds, F diff) {
+  diff(frames[1], frames[0]); // Warm up
+  size_t allocs = numAllocs;
+  auto start = std::chrono::steady_clock::now();
+  size_t n = 0;
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 1; i < frames.size(); i++, n++) {
+      diff(frames[i], frames[i - 1]);
+    }
+  }
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  std::printf(
+      "%-10s %10.1f allocs/diff %10.2f us/diff\n",
+      name,
+      double(numAllocs - allocs) / n,
+      us / n);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : 20;
+  std::vector<Frame*> frames;
+  for (int t = 0; t < kNumFrames; t++) {
+    frames.push_back(makeFrame(t));
+  }
+
+  run("fresh", frames, rounds, [](Frame* f, Frame* prev) {
+    auto df = frame_diff(f, prev);
+    (void)df;
+  });
+  FrameDiff reused;
+  run("reused", frames, rounds, [&reused](Frame* f, Frame* prev) {
+    frame_diff(reused, f, prev);
+  });
+
+  for (auto f : frames) {
+    f->decref();
+  }
+  return 0;
+}
@@ -7,10 +7,20 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include "lest/lest.hpp"
 #include "frame.h"
 #include "flatbuffers.h"
+#include "mapped_replay.h"
+#include "replayer.h"
+#include "unit_compare.h"
+
+#ifdef WITH_ZSTD
+#include "zstdstream.h"
+#endif
 
 namespace torchcraft {
 namespace replayer {
@@ -39,7 +49,7 @@ bool operator==(const Unit& a, const Unit& b) {
     E(armor) E(shieldArmor) E(size) E(pixel_x) E(pixel_y)
     E(pixel_size_x) E(pixel_size_y) E(groundATK) E(airATK)
     E(groundDmgType) E(airDmgType) E(groundRange) E(airRange)
-    E(orders) E(command) E(velocityX) E(velocityY)
+    E(orders_size) E(command) E(velocityX) E(velocityY)
     E(playerId) E(resources) E(buildTechUpgradeType)
     E(remainingBuildTrainTime) E(remainingUpgradeResearchTime) E(spellCD)
     E(associatedUnit) E(associatedCount);
@@ -48,13 +58,19 @@ bool operator==(const Unit& a, const Unit& b) {
 namespace detail {
   bool operator==(const UnitDiff& a, const UnitDiff& b) {
     return true
-    E(id) E(var_ids) E(var_diffs) E(order_ids) E(order_diffs)
-      E(order_size) E(velocityX) E(velocityY) E(flags);
+    E(id) E(var_mask) E(var_diffs) E(order_ids) E(order_diffs)
+      E(order_size) E(velocityX) E(velocityY) E(flags) E(parts);
+  }
+
+  bool operator==(const ResourcesDiff& a, const ResourcesDiff& b) {
+    return true
+      E(ore) E(gas) E(used_psi) E(total_psi)
+      E(upgrades) E(upgrades_level) E(techs);
   }
 }
 
-template<typename T1, typename T2>
-std::vector<std::pair<T1, T2>> sortMap(std::unordered_map<T1, T2> map) {
+template<typename T2, typename T1 = int32_t>
+std::vector<std::pair<T1, T2>> sortMap(const PlayerMap<T2>& map) {
   auto comparator = [](
     const std::pair<T1, T2>& a,
     const std::pair<T1, T2>& b) {
@@ -66,6 +82,40 @@ std::vector<std::pair<T1, T2>> sortMap(std::unordered_map<T1, T2> map) {
   return output;
 }
 
+// A small game: two players whose units move, get hurt and die over time
+Frame* makeGameFrame(int t) {
+  auto f = new Frame();
+  f->width = 64;
+  f->height = 32;
+  f->reward = t;
+  f->is_terminal = 0;
+  f->creep_map.assign(f->width * f->height / 128, 0);
+  f->creep_map[t % f->creep_map.size()] = t & 0xFF;
+  f->bullets = {{t, t + 1, t + 2}};
+  for (int32_t pid = 0; pid < 2; pid++) {
+    f->resources[pid] = {50 + t, 10 * pid, 4, 10, 0, 0, uint64_t(t / 7)};
+    f->actions[pid] = {{{t, pid}, t, pid}};
+    auto& units = f->units[pid];
+    for (int32_t id = 0; id < 12; id++) {
+      if ((id + pid) % 5 == t % 5) // Vanishes every once in a while
+        continue;
+      Unit u = Unit();
+      u.id = 100 * pid + id;
+      u.x = id + t / 3;
+      u.y = id * 2 - t / 4;
+      u.health = 40 - (t + id) % 40;
+      u.type = id % 3;
+      u.playerId = pid;
+      u.velocityX = 0.5 * (t % 3);
+      u.flags = t % 2 ? Unit::Flags::Moving : Unit::Flags::Idle;
+      f->setOrders(u, {{t - t % 4, 1 + id % 2, -1, u.x + 1, u.y + 1}});
+      u.command.frame = t;
+      units.push_back(u);
+    }
+  }
+  return f;
+}
+
 const lest::test specification[] = {
   lest_CASE("A TorchCraft Frame is invariant through serialization") {
     SETUP("Create & serialize a frame") {
@@ -106,10 +156,14 @@ const lest::test specification[] = {
       U(associatedUnit) U(associatedCount)
       u5000.visible = u1000.visible = true;
       u6000.visible = u2000.visible = false;
-      u1000.orders = {{ 10, 11, 12, 13, 14 }, { -10, -11, -12, -13, -14 }};
-      u2000.orders = {{ 20, 21, 22, 23, 24 }, { -20, -21, -22, -23, -24 }};
-      u5000.orders = {{ 50, 51, 52, 53, 54 }, { -50, -51, -52, -53, -54 }};
-      u6000.orders = {{ 60, 61, 62, 63, 64 }, { -60, -61, -62, -63, -64 }};
+      frameBefore.setOrders(
+          u1000, {{ 10, 11, 12, 13, 14 }, { -10, -11, -12, -13, -14 }});
+      frameBefore.setOrders(
+          u2000, {{ 20, 21, 22, 23, 24 }, { -20, -21, -22, -23, -24 }});
+      frameBefore.setOrders(
+          u5000, {{ 50, 51, 52, 53, 54 }, { -50, -51, -52, -53, -54 }});
+      frameBefore.setOrders(
+          u6000, {{ 60, 61, 62, 63, 64 }, { -60, -61, -62, -63, -64 }});
       u1000.command = { 101, 102, 103, 104, 105, 106 };
       u2000.command = { 201, 202, 203, 204, 205, 206 };
       u5000.command = { 501, 502, 503, 504, 505, 506 };
@@ -145,6 +199,7 @@ const lest::test specification[] = {
       EXPECT(matchingResources);
       EXPECT(matchingActions);
       EXPECT(matchingUnits);
+      EXPECT(detail::frameEq(&frameBefore, &frameAfter));
     }
   },
   
@@ -154,34 +209,35 @@ const lest::test specification[] = {
       diffBefore.reward = 1.1;
       diffBefore.is_terminal = ! diffBefore.is_terminal;
       diffBefore.pids = {1, 2, 3};
-      diffBefore.creep_map = {{11, 12}, {21, 22}};
+      diffBefore.creep_map = {{11, 12}, {12, 0}, {13, 255}, {21, 22}, {999, 1}};
       diffBefore.bullets = {{11, 12, 13}, {21, 22, 23}};
       diffBefore.resources = {
-        {11, {12, 13, 14, 15, 16, 17, 18}},
-        {21, {22, 23, 24, 25, 26, 27, 28}}};
+        {11, {12, -13, 0, 15, 0, 1ull << 63, 18}},
+        {-21, {0, 0, 0, 0, 0, 0, 0}},
+        {31, {INT32_MIN, INT32_MAX, 0, 0, ~0ull, 0, 0}}};
       diffBefore.actions = {
         {100, {{{111, 112}, 113, 114}, {{121, 122}, 123, 124}}},
         {200, {{{211, 212}, 213, 214}, {{221, 222}, 223, 224}}}};
       diffBefore.units = {
         {{
-          100, {121, 122}, {131, 132}, {141, 142}, {151, 152},
-          161, 162.5, 163.5, 164
+          100, 0x6, {131, -132}, {141, 142}, {151, 152},
+          161, 162.5, 163.5, 164, detail::UnitDiff::AllParts
         }, {
-          200, {221, 222}, {231, 232}, {241, 242}, {251, 252},
-          261, 262.5, 263.5, 264}},
+          200, 0x100000021, {0, 63, -64}, {241, 242}, {251, 252},
+          261, 262.5, 263.5, 264, detail::UnitDiff::AllParts}},
         {{
-          300, {321, 322}, {331, 332}, {341, 342}, {351, 352},
-          361, 362.5, 363.5, 364
+          300, 0, {}, {341, 342}, {351, 352},
+          0, 0, 0, 364, detail::UnitDiff::Flags
         }, {
-          400, {421, 422}, {431, 432}, {441, 442}, {451, 452},
-          461, 462.5, 463.5, 464}}};
+          400, 0x8000000000000001, {INT32_MIN, INT32_MAX},
+          {441, 442}, {451, 452}, 461, 462.5, 463.5, 0,
+          detail::UnitDiff::Velocity | detail::UnitDiff::OrderSize}}};
+      diffBefore.removed = {{50, 150}, {}};
           
       std::stringstream buffer;
       buffer << diffBefore;
       buffer >> diffAfter;
       
-      auto sortedCreepBefore = sortMap(diffBefore.creep_map);
-      auto sortedCreepAfter = sortMap(diffAfter.creep_map);
       auto sortedResourcesBefore = sortMap(diffBefore.resources);
       auto sortedResourcesAfter = sortMap(diffAfter.resources);
       auto sortedActionsBefore = sortMap(diffBefore.actions);
@@ -190,10 +246,11 @@ const lest::test specification[] = {
       // Lest tries to fancy-print EXPECT arguments.
       // But it but doesn't know how to print these complex objects.
       // So we do the comparison here and feed Lest the results.
-      auto matchingCreep = sortedCreepBefore == sortedCreepAfter;
+      auto matchingCreep = diffBefore.creep_map == diffAfter.creep_map;
       auto matchingResources = sortedResourcesBefore == sortedResourcesAfter;
       auto matchingActions = sortedActionsBefore == sortedActionsAfter;
-      auto matchingUnits = diffBefore.units == diffAfter.units;
+      auto matchingUnits = diffBefore.units == diffAfter.units &&
+          diffBefore.removed == diffAfter.removed;
       
       EXPECT(diffBefore.reward == diffAfter.reward);
       EXPECT(diffBefore.is_terminal == diffAfter.is_terminal);
@@ -202,7 +259,1123 @@ const lest::test specification[] = {
       EXPECT(matchingResources);
       EXPECT(matchingActions);
       EXPECT(matchingUnits);      
+      EXPECT_NOT(diffAfter.all_units);
+      EXPECT_NOT(diffAfter.all_resources);
     }        
+  },
+
+  lest_CASE("FrameDiffs written by older versions can be read") {
+    SETUP("Serialize unit and creep changes as (id, value) pairs") {
+      flatbuffers::FlatBufferBuilder builder;
+      std::vector<int32_t> varIds = {5, 1, 3};
+      std::vector<int32_t> varDiffs = {-50, 10, 30};
+      std::vector<int32_t> noOrders;
+      auto fbsUnits = std::vector<flatbuffers::Offset<fbs::UnitDiff>>{
+          fbs::CreateUnitDiffDirect(
+              builder, 7, &varIds, &varDiffs, &noOrders, &noOrders, 0)};
+      auto fbsContainers =
+          std::vector<flatbuffers::Offset<fbs::UnitDiffContainer>>{
+              fbs::CreateUnitDiffContainerDirect(builder, &fbsUnits)};
+      std::vector<int32_t> pids = {0};
+      std::vector<flatbuffers::Offset<fbs::ActionsOfPlayer>> noActions;
+      std::vector<flatbuffers::Offset<fbs::ResourcesOfPlayer>> resources = {
+          fbs::CreateResourcesOfPlayer(
+              builder, 0, fbs::CreateResources(builder, 50, 8, 4, 10, 1))};
+      std::vector<fbs::Bullet> noBullets;
+      std::vector<fbs::FrameDiffCreep> creep = {{30, 3}, {10, 1}, {20, 2}};
+      builder.Finish(fbs::CreateFrameDiff(
+          builder,
+          builder.CreateVector(pids),
+          builder.CreateVector(fbsContainers),
+          builder.CreateVector(noActions),
+          builder.CreateVector(resources),
+          builder.CreateVectorOfStructs(noBullets),
+          builder.CreateVectorOfStructs(creep)));
+      FrameDiff diff;
+      diff.readFromFlatBufferTable(
+          *flatbuffers::GetRoot<fbs::FrameDiff>(builder.GetBufferPointer()));
+      auto& du = diff.units[0][0];
+      EXPECT(diff.all_units);
+      EXPECT(diff.all_resources);
+      EXPECT(du.parts == detail::UnitDiff::AllParts);
+      EXPECT(du.id == 7);
+      EXPECT(du.var_mask == 0x2Aull);
+      EXPECT((du.var_diffs == std::vector<int32_t>{10, 30, -50}));
+      EXPECT((diff.creep_map ==
+              std::vector<std::pair<uint32_t, uint8_t>>{
+                  {10, 1}, {20, 2}, {30, 3}}));
+
+      // Units that are not listed were removed, and resources are replaced
+      Frame base;
+      base.width = base.height = 64; // Room for 32 bytes of creep
+      base.units[0].resize(2);
+      base.units[0][0].id = 7;
+      base.units[0][1].id = 8;
+      base.resources[0] = {20, 2, 2, 10, 0, 0, 0};
+      auto undiffed = frame_undiff(&diff, &base);
+      EXPECT(undiffed->units[0].size() == 1u);
+      EXPECT(undiffed->units[0][0].y == 10);
+      bool resourcesMatch =
+          undiffed->resources.at(0) == Resources{50, 8, 4, 10, 1, 0, 0};
+      EXPECT(resourcesMatch);
+      undiffed->decref();
+
+      // Unit diffs with no deltas at all are rejected
+      flatbuffers::FlatBufferBuilder empty;
+      auto fbsEmpty = std::vector<flatbuffers::Offset<fbs::UnitDiff>>{
+          fbs::CreateUnitDiffDirect(empty, 7)};
+      auto emptyContainers =
+          std::vector<flatbuffers::Offset<fbs::UnitDiffContainer>>{
+              fbs::CreateUnitDiffContainerDirect(empty, &fbsEmpty)};
+      empty.Finish(fbs::CreateFrameDiff(
+          empty,
+          empty.CreateVector(pids),
+          empty.CreateVector(emptyContainers),
+          empty.CreateVector(noActions),
+          0,
+          empty.CreateVectorOfStructs(noBullets),
+          empty.CreateVectorOfStructs(creep)));
+      FrameDiff invalid;
+      EXPECT_THROWS(invalid.readFromFlatBufferTable(
+          *flatbuffers::GetRoot<fbs::FrameDiff>(empty.GetBufferPointer())));
+    }
+  },
+
+  lest_CASE("FrameDiffs only list units that changed") {
+    SETUP("Move, remove, add and speed up units") {
+      Frame before;
+      auto& units = before.units[0];
+      for (int32_t id = 1; id <= 5; id++) {
+        Unit u = Unit();
+        u.id = id;
+        u.x = 10 * id;
+        u.velocityX = 1;
+        u.flags = Unit::Flags::Idle;
+        before.setOrders(u, {{0, id, -1, 0, 0}});
+        units.push_back(u);
+      }
+      Frame after(before);
+      auto& next = after.units[0];
+      next[1].x += 2;
+      next[3].velocityY = 0.5;
+      next.erase(next.begin() + 2);
+      next.push_back(next[0]);
+      next.back().id = 6;
+      after.setOrders(next.back(), {});
+
+      auto diff = frame_diff(&after, &before);
+      auto& du = diff.units[0];
+      EXPECT(du.size() == 3u);
+      EXPECT(du[0].id == 2);
+      EXPECT(du[0].parts == 0);
+      EXPECT(du[0].var_mask == 1ull);
+      EXPECT(du[1].id == 4);
+      EXPECT(du[1].parts == detail::UnitDiff::Velocity);
+      EXPECT(du[1].var_diffs.empty());
+      EXPECT(du[2].id == 6);
+      EXPECT(du[2].parts == detail::UnitDiff::AllParts);
+      auto removed = diff.removed[0] == std::vector<int32_t>{3};
+      EXPECT(removed);
+
+      auto undiffed = frame_undiff(&diff, &before);
+      EXPECT(detail::frameEq(undiffed, &after));
+      undiffed->decref();
+
+      std::stringstream ss;
+      FrameDiff read;
+      ss << diff;
+      ss >> read;
+      undiffed = frame_undiff(&read, &before);
+      EXPECT(detail::frameEq(undiffed, &after));
+      undiffed->decref();
+    }
+  },
+
+  lest_CASE("Resources are diffed field by field") {
+    SETUP("Mine, research and let players come and go") {
+      Frame before, after;
+      before.resources[0] = {100, 50, 10, 20, 0x3, 0x1, 0x10};
+      before.resources[1] = {60, 0, 4, 10, 0, 0, 0};
+      after.resources[0] = {108, 50, 10, 20, 0x3, 0x1, 0x30};
+      after.resources[2] = {50, 0, 4, 10, 0, 0, 0x1};
+
+      auto diff = frame_diff(&after, &before);
+      EXPECT(diff.resources.size() == 2u);
+      EXPECT(diff.resources.count(1) == 0u);
+      bool changes = diff.resources.at(0) ==
+              detail::ResourcesDiff{8, 0, 0, 0, 0, 0, 0x20} &&
+          diff.resources.at(2) ==
+              detail::ResourcesDiff{50, 0, 4, 10, 0, 0, 0x1};
+      EXPECT(changes);
+
+      std::stringstream ss;
+      FrameDiff read;
+      ss << diff;
+      ss >> read;
+      EXPECT_NOT(read.all_resources);
+      for (auto d : {&diff, &read}) {
+        auto undiffed = frame_undiff(d, &before);
+        bool resourcesMatch = undiffed->resources == after.resources;
+        EXPECT(resourcesMatch);
+        undiffed->decref();
+      }
+
+      // Players whose resources did not change cost two bytes
+      Frame idle(before);
+      flatbuffers::FlatBufferBuilder idleBuilder;
+      idleBuilder.Finish(frame_diff(&idle, &before).addToFlatBufferBuilder(
+          idleBuilder));
+      auto fbsIdle =
+          flatbuffers::GetRoot<fbs::FrameDiff>(idleBuilder.GetBufferPointer());
+      EXPECT(fbsIdle->resource_deltas()->size() == 4u);
+      EXPECT(fbsIdle->resources() == nullptr);
+    }
+  },
+
+  lest_CASE("Creep maps are resized by diffs") {
+    SETUP("Diff between frames without creep, a smaller and a full map") {
+      // 32 bytes of creep at most on a map of 16x16 build tiles
+      Frame noCreep, small, large;
+      for (auto f : {&noCreep, &small, &large}) {
+        f->width = f->height = 64;
+      }
+      small.creep_map.assign(16, 1);
+      large.creep_map.assign(32, 0);
+      large.creep_map[3] = 5;
+      large.creep_map[20] = 7;
+      large.creep_map[31] = 9;
+
+      std::vector<std::pair<Frame*, Frame*>> pairs = {
+          {&large, &noCreep},
+          {&large, &small},
+          {&small, &large},
+          {&noCreep, &large}};
+      bool matching = true;
+      for (const auto& p : pairs) {
+        auto diff = frame_diff(p.first, p.second);
+        std::stringstream ss;
+        FrameDiff read;
+        ss << diff;
+        ss >> read;
+        matching &= read.creep_size == int32_t(p.first->creep_map.size());
+        auto undiffed = frame_undiff(&read, p.second);
+        matching &= undiffed->creep_map == p.first->creep_map;
+        undiffed->decref();
+      }
+      EXPECT(matching);
+
+      // Changes within maps of the same size stay sparse
+      Frame changed(large);
+      changed.creep_map[20] = 0;
+      auto diff = frame_diff(&changed, &large);
+      EXPECT(diff.creep_map.size() == 1u);
+      auto undiffed = frame_undiff(&diff, &large);
+      EXPECT(undiffed->creep_map == changed.creep_map);
+      undiffed->decref();
+
+      // Sizes and indices beyond the map are rejected
+      diff.creep_size = 33;
+      EXPECT_THROWS(frame_undiff(&diff, &large));
+      diff.creep_size = 32;
+      diff.creep_map = {{32, 1}};
+      EXPECT_THROWS(frame_undiff(&diff, &large));
+      diff.creep_size = -1; // Written by older versions
+      diff.creep_map = {{1u << 30, 1}};
+      EXPECT_THROWS(frame_undiff(&diff, &large));
+    }
+  },
+
+  lest_CASE("Units are compared word by word") {
+    SETUP("Change fields of a unit one at a time") {
+      Unit base = Unit();
+      base.id = 7;
+      base.health = 40;
+      base.velocityX = 1.5;
+      base.flags = Unit::Flags::Moving;
+      EXPECT(detail::changedUnitWords(base, base) == 0ull);
+
+      auto wordOf = [](const Unit& u, const void* field) {
+        return (reinterpret_cast<const char*>(field) -
+                reinterpret_cast<const char*>(&u)) /
+            4;
+      };
+      bool matching = true;
+      for (int k = 0; k < 4; k++) {
+        Unit u = base;
+        int32_t* field = &u.x;
+        switch (k) {
+          case 1:
+            field = &u.pixel_y;
+            break;
+          case 2:
+            field = &u.command.extra;
+            break;
+          case 3:
+            field = &u.associatedCount;
+            break;
+        }
+        *field += 1;
+        auto words = detail::changedUnitWords(u, base);
+        matching &= words == detail::changedUnitWordsScalar(u, base);
+        matching &= words == 1ull << wordOf(u, field);
+      }
+      EXPECT(matching);
+
+      Unit u = base;
+      u.velocityX = -1.5;
+      u.flags |= Unit::Flags::Attacking;
+      auto words = detail::changedUnitWords(u, base);
+      EXPECT(words == detail::changedUnitWordsScalar(u, base));
+      auto velocityWords = 3ull << wordOf(u, &u.velocityX);
+      auto flagsWords = 3ull << wordOf(u, &u.flags);
+      EXPECT((words & velocityWords) != 0ull);
+      EXPECT((words & flagsWords) != 0ull);
+      EXPECT((words & ~velocityWords & ~flagsWords) == 0ull);
+    }
+  },
+
+  lest_CASE("Players are diffed and undiffed in parallel consistently") {
+    SETUP("Diff a game on one thread and on a pool of threads") {
+      std::vector<Frame*> frames;
+      for (int t = 0; t < 30; t++) {
+        frames.push_back(makeGameFrame(t));
+      }
+      // Diffs and undiffed frames of the whole game
+      auto diffAll = [&frames]() {
+        std::vector<std::pair<FrameDiff, Frame*>> out;
+        for (size_t t = 1; t < frames.size(); t++) {
+          auto diff = frame_diff(frames[t], frames[t - 1]);
+          auto undiffed = frame_undiff(&diff, frames[t - 1]);
+          out.emplace_back(std::move(diff), undiffed);
+        }
+        return out;
+      };
+      auto same = [&frames](
+          const std::vector<std::pair<FrameDiff, Frame*>>& a,
+          const std::vector<std::pair<FrameDiff, Frame*>>& b) {
+        bool matching = a.size() == b.size();
+        for (size_t i = 0; matching && i < a.size(); i++) {
+          matching &= a[i].first.pids == b[i].first.pids &&
+              a[i].first.units == b[i].first.units &&
+              a[i].first.removed == b[i].first.removed &&
+              detail::frameEq(a[i].second, b[i].second) &&
+              detail::frameEq(a[i].second, frames[i + 1]);
+        }
+        return matching;
+      };
+      auto release = [](std::vector<std::pair<FrameDiff, Frame*>>& diffs) {
+        for (auto& d : diffs) {
+          d.second->decref();
+        }
+      };
+
+      auto sequential = diffAll();
+      setDiffThreads(3, 0);
+      auto parallel = diffAll();
+      EXPECT(same(sequential, parallel));
+      release(parallel);
+
+      // Threads that find the pool busy work on their own
+      std::vector<std::pair<FrameDiff, Frame*>> results[3];
+      std::vector<std::thread> threads;
+      for (auto& r : results) {
+        threads.emplace_back([&r, &diffAll]() { r = diffAll(); });
+      }
+      for (auto& t : threads) {
+        t.join();
+      }
+      bool matching = true;
+      for (auto& r : results) {
+        matching &= same(sequential, r);
+        release(r);
+      }
+      EXPECT(matching);
+
+      // Small frames stay on the calling thread
+      setDiffThreads(3, 1000);
+      parallel = diffAll();
+      EXPECT(same(sequential, parallel));
+      release(parallel);
+      setDiffThreads(1);
+      release(sequential);
+      for (auto f : frames) {
+        f->decref();
+      }
+    }
+  },
+
+  lest_CASE("Predictive diffs encode positions relative to velocities") {
+    SETUP("Diff frames of units moving at a steady pace") {
+      const char* path = "predictive_replay_test.tcr";
+      // Frames are 3 game frames apart
+      auto makeFrame = [](int t) {
+        auto f = new Frame();
+        for (int32_t id = 0; id < 10; id++) {
+          Unit u = Unit();
+          u.id = id;
+          u.velocityX = 0.5 * id;
+          u.velocityY = id == 9 ? -4 : 0;
+          u.pixel_x = 100 + std::lround(1.5 * id * t);
+          u.pixel_y = 500 - (id == 9 ? 12 * t : 0);
+          u.x = u.pixel_x / 8;
+          u.y = u.pixel_y / 8;
+          u.health = id == 3 ? 40 - t : 40;
+          f->units[0].push_back(u);
+        }
+        return f;
+      };
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < 9; t++) {
+        auto f = makeFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+
+      auto plain = frame_diff(rep.getFrame(2), rep.getFrame(1));
+      auto diff = frame_diff(rep.getFrame(2), rep.getFrame(1), true);
+      EXPECT(plain.prediction_frames == 0u);
+      EXPECT(diff.prediction_frames == 3u);
+      // Moving units are listed, but their pixel positions are predicted
+      size_t plainDeltas = 0, deltas = 0;
+      for (auto& du : plain.units[0])
+        plainDeltas += du.var_diffs.size();
+      for (auto& du : diff.units[0])
+        deltas += du.var_diffs.size();
+      EXPECT(diff.units[0].size() == plain.units[0].size());
+      EXPECT(deltas < plainDeltas);
+      auto undiffed = frame_undiff(&diff, rep.getFrame(1));
+      EXPECT(detail::frameEq(undiffed, rep.getFrame(2)));
+      undiffed->decref();
+
+      rep.setKeyFrame(4);
+      rep.setPredictive(true);
+      rep.save(path);
+      Replayer full, basics;
+      full.load(path);
+      basics.setFields(FrameFields::UnitBasics);
+      basics.load(path);
+      bool matching = true;
+      for (size_t i = 0; i < rep.size(); i++) {
+        matching &= detail::frameEq(full.getFrame(i), rep.getFrame(i), false);
+        const auto& units = basics.getFrame(i)->units[0];
+        const auto& expected = rep.getFrame(i)->units[0];
+        for (size_t j = 0; j < units.size(); j++) {
+          matching &= units[j].x == expected[j].x &&
+              units[j].y == expected[j].y &&
+              units[j].pixel_x == expected[j].pixel_x &&
+              units[j].pixel_y == expected[j].pixel_y &&
+              units[j].health == expected[j].health;
+        }
+      }
+      EXPECT(matching);
+      std::remove(path);
+
+      // Tiny velocities yield the longest prediction rather than overflowing
+      Frame slow, moved;
+      Unit u = Unit();
+      u.velocityX = 1e-160;
+      u.pixel_x = 100;
+      slow.units[0].push_back(u);
+      u.pixel_x = 140;
+      u.x = u.pixel_x / 8;
+      moved.units[0].push_back(u);
+      auto slowDiff = frame_diff(&moved, &slow, true);
+      EXPECT(slowDiff.prediction_frames == 1000u);
+      undiffed = frame_undiff(&slowDiff, &slow);
+      EXPECT(detail::frameEq(undiffed, &moved));
+      undiffed->decref();
+    }
+  },
+
+  lest_CASE("A FrameDiff can be re-used across frame_diff calls") {
+    SETUP("Diff consecutive frames into the same FrameDiff") {
+      FrameDiff reused;
+      bool matching = true, undiffing = true;
+      Frame* prev = makeGameFrame(0);
+      for (int t = 1; t < 20; t++) {
+        auto f = makeGameFrame(t);
+        if (t % 6 == 0) // Players come and go, too
+          f->units.erase(t % 12 == 0 ? 0 : 1);
+        frame_diff(reused, f, prev);
+        auto fresh = frame_diff(f, prev);
+        matching &= reused.pids == fresh.pids && reused.units == fresh.units &&
+            reused.creep_map == fresh.creep_map;
+        auto undiffed = frame_undiff(&reused, prev);
+        undiffing &= detail::frameEq(undiffed, f);
+        undiffed->decref();
+        prev->decref();
+        prev = f;
+      }
+      prev->decref();
+      EXPECT(matching);
+      EXPECT(undiffing);
+    }
+  },
+
+  lest_CASE("Diffs can be applied to a frame in place") {
+    SETUP("Undiff consecutive frames into the same Frame") {
+      bool undiffing = true, sameCreep = true;
+      Frame* prev = makeGameFrame(0);
+      Frame inplace(prev);
+      for (auto& p : inplace.units) // Unsorted units are fine, too
+        std::reverse(p.second.begin(), p.second.end());
+      auto creep = inplace.creep_map.data();
+      for (int t = 1; t < 20; t++) {
+        auto f = makeGameFrame(t);
+        if (t % 6 == 0)
+          f->units.erase(t % 12 == 0 ? 0 : 1);
+        auto diff = frame_diff(f, prev);
+        frame_undiff(&inplace, &inplace, &diff);
+        undiffing &= detail::frameEq(&inplace, f) && inplace.units_sorted;
+        sameCreep &= inplace.creep_map.data() == creep;
+        prev->decref();
+        prev = f;
+      }
+      prev->decref();
+      EXPECT(undiffing);
+      EXPECT(sameCreep);
+    }
+  },
+
+  lest_CASE("Frames from a FramePool are recycled") {
+    SETUP("Get frames from a pool, fill and release them") {
+      FramePool pool(1);
+      auto f = pool.get();
+      auto g = makeGameFrame(5);
+      *f = *g;
+      auto unitsCapacity = f->units[0].capacity();
+      auto creepCapacity = f->creep_map.capacity();
+      f->decref();
+      EXPECT(pool.size() == 1u);
+
+      auto recycled = pool.get();
+      EXPECT(recycled == f);
+      EXPECT(pool.size() == 0u);
+      EXPECT(recycled->units.empty());
+      EXPECT(recycled->creep_map.empty());
+      EXPECT(recycled->creep_map.capacity() == creepCapacity);
+      EXPECT(recycled->playerUnits(0).capacity() == unitsCapacity);
+
+      // The pool is full: other frames are freed
+      auto other = pool.get();
+      recycled->decref();
+      other->decref();
+      EXPECT(pool.size() == 1u);
+
+      // Frames may outlive their pool
+      auto pool2 = new FramePool();
+      auto h = pool2->get();
+      delete pool2;
+      h->incref();
+      h->decref();
+      h->decref();
+      g->decref();
+    }
+  },
+
+  lest_CASE("A PlayerMap behaves like a map from player ids") {
+    SETUP("Insert, look up and erase players") {
+      PlayerMap<std::vector<int32_t>> m;
+      auto& first = m[5000];
+      first.push_back(1);
+      m[1000] = {2, 3};
+      EXPECT(m.insert({1000, {4}}).second == false);
+      EXPECT(m.emplace(7, std::vector<int32_t>{5}).second);
+      EXPECT(m.size() == 3u);
+      // Inserting keeps references valid
+      EXPECT(&first == &m.at(5000));
+      EXPECT(m.count(1000) == 1u);
+      EXPECT(m.find(3) == m.end());
+      EXPECT_THROWS_AS(m.at(3), std::out_of_range);
+
+      EXPECT(m.erase(5000) == 1u);
+      EXPECT(m.erase(5000) == 0u);
+      EXPECT(m.size() == 2u);
+      auto matching = m.at(1000) == std::vector<int32_t>({2, 3}) &&
+          m.at(7) == std::vector<int32_t>({5});
+      EXPECT(matching);
+
+      // Comparison ignores the order of players
+      PlayerMap<std::vector<int32_t>> n = {{7, {5}}, {1000, {2, 3}}};
+      bool equal = m == n;
+      n[7].clear();
+      bool different = m != n;
+      EXPECT(equal);
+      EXPECT(different);
+
+      for (int32_t pid = 0; m.size() < PlayerMap<int>::kCapacity; pid++) {
+        m[pid];
+      }
+      EXPECT_THROWS_AS(m[100], std::runtime_error);
+      m.clear();
+      EXPECT(m.empty());
+      EXPECT(m.begin() == m.end());
+    }
+  },
+
+  lest_CASE("Orders of units are kept in the order pool of their frame") {
+    SETUP("Add orders to units and combine frames") {
+      Frame f;
+      auto& units = f.units[0];
+      units.resize(2);
+      units[0].id = 1;
+      units[1].id = 2;
+      f.addOrder(units[0], {1, 10, -1, 0, 0});
+      f.addOrder(units[1], {1, 20, -1, 0, 0});
+      // Orders of the first unit are no longer at the end of the pool
+      f.addOrder(units[0], {2, 11, -1, 0, 0});
+      EXPECT(f.unitOrders(units[0]).size() == 2u);
+      EXPECT(f.unitOrders(units[0])[0].type == 10);
+      EXPECT(f.unitOrders(units[0]).back().type == 11);
+      EXPECT(f.unitOrders(units[1]).back().type == 20);
+
+      Frame next;
+      next.units[0].resize(1);
+      next.units[0][0].id = 2;
+      next.setOrders(next.units[0][0], {{3, 20, -1, 0, 0}, {3, 21, -1, 0, 0}});
+      next.units[1].resize(1);
+      next.units[1][0].id = 3;
+      next.setOrders(next.units[1][0], {{3, 30, -1, 0, 0}});
+      f.combine(next);
+      // Repeated orders are only listed once
+      auto combined = f.unitOrders(f.units[0][1]);
+      EXPECT(combined.size() == 2u);
+      EXPECT(combined[0].type == 20);
+      EXPECT(combined[1].type == 21);
+      EXPECT(f.unitOrders(f.units[0][0]).size() == 2u);
+      EXPECT(f.unitOrders(f.units[1][0])[0].type == 30);
+      EXPECT(f.orders.size() == 5u);
+
+      Unit stranger = Unit();
+      stranger.orders_offset = 4;
+      stranger.orders_size = 2;
+      EXPECT(f.unitOrders(stranger).empty());
+    }
+  },
+
+  lest_CASE("Frames with sorted units are diffed and combined consistently") {
+    SETUP("Sort the units of frames whose units are shuffled") {
+      auto shuffled = [](int t) {
+        auto f = makeGameFrame(t);
+        for (auto& p : f->units)
+          std::reverse(p.second.begin(), p.second.end());
+        return f;
+      };
+      Frame* a = shuffled(3);
+      Frame* b = shuffled(4);
+      Frame sa(a), sb(b);
+      sa.sortUnits();
+      sb.sortUnits();
+      EXPECT_NOT(a->units_sorted);
+      EXPECT(sa.units_sorted);
+      EXPECT(std::is_sorted(
+          sa.units[0].begin(), sa.units[0].end(), detail::orderUnitByiD));
+
+      auto diff = frame_diff(b, a);
+      auto sortedDiff = frame_diff(&sb, &sa);
+      EXPECT(diff.units == sortedDiff.units);
+      auto undiffed = frame_undiff(&sortedDiff, &sa);
+      EXPECT(undiffed->units_sorted);
+      EXPECT(detail::frameEq(undiffed, b));
+
+      // Deserialized frames have their units sorted
+      std::stringstream ss;
+      ss << *a;
+      Frame read;
+      ss >> read;
+      EXPECT(read.units_sorted);
+      EXPECT(read.units[1] == sa.units[1]);
+
+      // Units that are new in the combined frame are merged in, and units of
+      // combined frames are ordered by id in any case
+      Frame combined(sa), unsortedCombined(a), movedCombined(a);
+      combined.combine(sb);
+      unsortedCombined.combine(*b);
+      EXPECT(combined.units_sorted);
+      EXPECT(unsortedCombined.units_sorted);
+      EXPECT(combined.units[0] == unsortedCombined.units[0]);
+      EXPECT(combined.units[1] == unsortedCombined.units[1]);
+      EXPECT(detail::frameEq(&combined, &unsortedCombined));
+      // Consuming the next frame gives the same result as copying from it
+      Frame consumed(b);
+      movedCombined.combine(std::move(consumed));
+      EXPECT(detail::frameEq(&movedCombined, &combined));
+      EXPECT(movedCombined.creep_map == combined.creep_map);
+
+      undiffed->decref();
+      a->decref();
+      b->decref();
+    }
+  },
+
+  lest_CASE("Lazily and concurrently loaded Replayers match the saved one") {
+    SETUP("Save a replay with keyframes, load it lazily") {
+      const int numFrames = 23;
+      const char* path = "lazy_replay_test.tcr";
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(5);
+      rep.setNumUnits();
+      rep.save(path);
+
+      Replayer eager, parallel, lazy;
+      eager.load(path);
+      parallel.load(path, false, 4);
+      lazy.load(path, true);
+      lazy.setCacheSize(3);
+
+      EXPECT(lazy.isLazy());
+      EXPECT(lazy.size() == rep.size());
+      EXPECT(lazy.getKeyFrame() == 5u);
+      EXPECT(lazy.mapHeight() == 16);
+      EXPECT(lazy.getNumUnits(0) == rep.getNumUnits(0));
+      // Random access, going back and forth across segments
+      for (int i : {22, 3, 4, 17, 0, 21, 9, 10, 5, 22}) {
+        EXPECT(detail::frameEq(lazy.getFrame(i), rep.getFrame(i)));
+        EXPECT(detail::frameEq(lazy.getFrame(i), eager.getFrame(i)));
+      }
+      for (int i = 0; i < numFrames; i++) {
+        EXPECT(detail::frameEq(parallel.getFrame(i), rep.getFrame(i)));
+      }
+      EXPECT(lazy.getFrame(numFrames) == nullptr);
+      std::remove(path);
+    }
+  },
+
+  lest_CASE("A compact Replayer rebuilds frames from keyframes and diffs") {
+    SETUP("Compact a replay, keep pushing frames, save it") {
+      const int numFrames = 30;
+      const char* path = "compact_replay_test.tcr";
+      Replayer ref, rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        ref.push(f);
+        if (t < 20)
+          rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(7);
+      rep.compact();
+      rep.setCacheSize(2);
+      for (int t = 20; t < numFrames; t++) {
+        rep.push(ref.getFrame(t));
+      }
+      rep.setNumUnits();
+      ref.setNumUnits();
+
+      EXPECT(rep.isCompact());
+      EXPECT(rep.size() == ref.size());
+      EXPECT(rep.getNumUnits(0) == ref.getNumUnits(0));
+      for (int i : {29, 3, 4, 16, 0, 21, 8, 7, 6, 20, 29}) {
+        EXPECT(detail::frameEq(rep.getFrame(i), ref.getFrame(i)));
+      }
+      EXPECT(rep.getFrame(numFrames) == nullptr);
+
+      rep.save(path);
+      Replayer loaded;
+      loaded.load(path);
+      EXPECT_NOT(loaded.isCompact());
+      for (int i = 0; i < numFrames; i++) {
+        EXPECT(detail::frameEq(loaded.getFrame(i), ref.getFrame(i)));
+      }
+      std::remove(path);
+    }
+  },
+
+  lest_CASE("Unit columns of a Replayer match its frames") {
+    SETUP("Flatten a replay, in memory and compacted") {
+      const int numFrames = 12;
+      Replayer rep;
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      auto cols = rep.getUnitColumns();
+      rep.setKeyFrame(4);
+      rep.compact();
+      auto compactCols = rep.getUnitColumns();
+
+      EXPECT(cols.frameOffsets.size() == size_t(numFrames + 1));
+      EXPECT(cols.frameOffsets.back() == cols.size());
+      EXPECT(cols.flags.size() == cols.size());
+      EXPECT(compactCols.id == cols.id);
+      EXPECT(compactCols.velocityX == cols.velocityX);
+      bool matching = true;
+      for (int i = 0; i < numFrames; i++) {
+        auto f = rep.getFrame(i);
+        auto k = cols.frameOffsets[i];
+        for (int32_t pid : {0, 1}) {
+          for (auto& u : f->units[pid]) {
+            matching &= cols.frame[k] == i && cols.playerId[k] == pid &&
+                cols.id[k] == u.id && cols.x[k] == u.x && cols.y[k] == u.y &&
+                cols.health[k] == u.health && cols.flags[k] == u.flags &&
+                cols.velocityX[k] == u.velocityX;
+            k++;
+          }
+        }
+        matching &= k == cols.frameOffsets[i + 1];
+      }
+      EXPECT(matching);
+    }
+  },
+
+#ifdef WITH_ZSTD
+  lest_CASE("Compressed replays can be loaded lazily and concurrently") {
+    SETUP("Save a compressed replay, load it in all modes") {
+      const int numFrames = 200;
+      const char* path = "zstd_replay_test.tcr";
+      const char* legacyPath = "zstd_legacy_replay_test.tcr";
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(10);
+      rep.setNumUnits();
+      rep.save(path, true);
+      {
+        // Single Zstd frame without seek table, as written previously
+        zstd::ofstream out(legacyPath);
+        out << rep;
+      }
+
+      Replayer eager, parallel, lazy, legacy;
+      eager.load(path);
+      parallel.load(path, false, 3);
+      lazy.load(path, true);
+      lazy.setCacheSize(4);
+      legacy.load(legacyPath, true, 2);
+
+      EXPECT(lazy.isLazy());
+      EXPECT_NOT(legacy.isLazy());
+      EXPECT(lazy.size() == rep.size());
+      EXPECT(lazy.getNumUnits(1) == rep.getNumUnits(1));
+      EXPECT(parallel.getNumUnits(1) == rep.getNumUnits(1));
+      for (int i : {199, 0, 75, 69, 70, 140, 3, 150}) {
+        EXPECT(detail::frameEq(lazy.getFrame(i), rep.getFrame(i)));
+      }
+      for (int i = 0; i < numFrames; i++) {
+        EXPECT(detail::frameEq(eager.getFrame(i), rep.getFrame(i)));
+        EXPECT(detail::frameEq(parallel.getFrame(i), rep.getFrame(i)));
+        EXPECT(detail::frameEq(legacy.getFrame(i), rep.getFrame(i)));
+      }
+      std::remove(path);
+      std::remove(legacyPath);
+
+      // Seek tables with invalid entry counts or sizes are ignored
+      auto table = zstd::makeSeekTable({{10, 20}, {30, 40}});
+      auto readTable = [](const std::string& bytes) {
+        std::stringbuf buf(bytes);
+        std::vector<zstd::seek_entry> entries;
+        return zstd::readSeekTable(&buf, entries) && entries.size() == 2u;
+      };
+      EXPECT(readTable(table));
+      auto wrapped = table;
+      wrapped[table.size() - 9 + 3] = 0x20; // 2^29 + 2 entries
+      EXPECT_NOT(readTable(wrapped));
+      auto mismatched = table;
+      mismatched[4] += 8; // Declared size of the skippable frame
+      EXPECT_NOT(readTable(mismatched));
+    }
+  },
+#endif // WITH_ZSTD
+
+  lest_CASE("Replays written by a ReplayWriter can be loaded in all modes") {
+    SETUP("Stream frames to disk, load them back") {
+      const int numFrames = 150;
+      std::vector<std::pair<const char*, bool>> files = {
+          {"writer_replay_test.tcr", false}};
+#ifdef WITH_ZSTD
+      files.emplace_back("writer_zstd_replay_test.tcr", true);
+#endif
+      std::vector<uint8_t> mapData(16 * 8, 2);
+      for (auto file : files) {
+        Replayer rep;
+        {
+          ReplayWriter writer(file.first, 7, file.second);
+          writer.setRawMap(16, 8, mapData.data());
+          for (int t = 0; t < numFrames; t++) {
+            auto f = makeGameFrame(t);
+            rep.push(f);
+            writer.push(f);
+            f->decref();
+          }
+          EXPECT(writer.size() == rep.size());
+          writer.close();
+          EXPECT_NOT(writer.isOpen());
+        }
+        rep.setNumUnits();
+
+        Replayer eager, parallel, lazy;
+        eager.load(file.first);
+        parallel.load(file.first, false, 3);
+        lazy.load(file.first, true);
+        lazy.setCacheSize(5);
+        for (auto r : {&eager, &parallel, &lazy}) {
+          EXPECT(r->size() == rep.size());
+          EXPECT(r->getKeyFrame() == 7u);
+          EXPECT(r->getRawMap()[3] == 2);
+          EXPECT(r->getNumUnits(0) == rep.getNumUnits(0));
+          EXPECT(r->getNumUnits(1) == rep.getNumUnits(1));
+        }
+        for (int i : {149, 0, 64, 70, 13, 140, 77}) {
+          EXPECT(detail::frameEq(lazy.getFrame(i), rep.getFrame(i)));
+        }
+        for (int i = 0; i < numFrames; i++) {
+          EXPECT(detail::frameEq(eager.getFrame(i), rep.getFrame(i)));
+          EXPECT(detail::frameEq(parallel.getFrame(i), rep.getFrame(i)));
+        }
+        std::remove(file.first);
+      }
+    }
+  },
+
+  lest_CASE("A ReplayReader yields the frames of a replay in order") {
+    SETUP("Save replays in several formats, read them back") {
+      const int numFrames = 30;
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(4);
+      rep.setNumUnits();
+
+      std::vector<const char*> paths = {"reader_replay_test.tcr",
+                                        "reader_writer_replay_test.tcr"};
+      rep.save(paths[0]);
+      {
+        ReplayWriter writer(paths[1], 4, true);
+        writer.setRawMap(16, 8, mapData.data());
+        for (int i = 0; i < numFrames; i++) {
+          writer.push(rep.getFrame(i));
+        }
+      }
+
+      for (auto path : paths) {
+        ReplayReader reader(path);
+        EXPECT(reader.size() == rep.size());
+        EXPECT(reader.getKeyFrame() == 4u);
+        EXPECT(reader.mapWidth() == 8);
+        EXPECT(reader.getNumUnits(0) == rep.getNumUnits(0));
+        Frame* first = reader.next();
+        EXPECT(detail::frameEq(first, rep.getFrame(0)));
+        for (int i = 1; i < numFrames; i++) {
+          auto f = reader.next();
+          EXPECT(f == first);
+          EXPECT(detail::frameEq(f, rep.getFrame(i)));
+        }
+        EXPECT(reader.next() == nullptr);
+        EXPECT(reader.next() == nullptr);
+        EXPECT(reader.position() == size_t(numFrames));
+        std::remove(path);
+      }
+    }
+  },
+
+  lest_CASE("Frames can be decoded partially") {
+    SETUP("Load a replay with a subset of FrameFields") {
+      const int numFrames = 17;
+      const char* path = "fields_replay_test.tcr";
+      const uint32_t fields = FrameFields::UnitBasics | FrameFields::Resources;
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(4);
+      rep.save(path);
+
+      // What decoding with `fields` should yield
+      auto project = [](Frame* f) {
+        auto p = new Frame(f);
+        p->actions.clear();
+        p->bullets.clear();
+        p->creep_map.clear();
+        for (auto& player : p->units) {
+          for (auto& u : player.second) {
+            Unit b = Unit();
+            b.id = u.id;
+            b.playerId = u.playerId;
+            b.type = u.type;
+            b.x = u.x;
+            b.y = u.y;
+            b.health = u.health;
+            b.max_health = u.max_health;
+            b.shield = u.shield;
+            b.max_shield = u.max_shield;
+            b.flags = u.flags;
+            b.visible = u.visible;
+            b.velocityX = u.velocityX;
+            b.velocityY = u.velocityY;
+            b.pixel_x = u.pixel_x;
+            b.pixel_y = u.pixel_y;
+            u = b;
+          }
+        }
+        return p;
+      };
+
+      Replayer eager, lazy;
+      eager.setFields(fields);
+      eager.load(path);
+      lazy.setFields(fields);
+      lazy.load(path, true);
+      ReplayReader reader(path, fields);
+      bool matching = true;
+      for (int i = 0; i < numFrames; i++) {
+        auto expected = project(rep.getFrame(i));
+        matching &= detail::frameEq(eager.getFrame(i), expected, false);
+        matching &= detail::frameEq(lazy.getFrame(i), expected, false);
+        matching &= detail::frameEq(reader.next(), expected, false);
+        matching &= eager.getFrame(i)->units[0][0] == expected->units[0][0];
+        expected->decref();
+      }
+      EXPECT(matching);
+      EXPECT(eager.getFrame(numFrames - 1)->resources.size() == 2u);
+      EXPECT(eager.getFrame(numFrames - 1)->units[1][0].orders_size == 0u);
+      std::remove(path);
+    }
+  },
+
+  lest_CASE("Replay headers are checked and text headers are still read") {
+    SETUP("Save a replay, truncate and corrupt it") {
+      const char* path = "header_replay_test.tcr";
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < 6; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(3);
+      rep.setNumUnits();
+      std::ostringstream saved;
+      saved << rep;
+      auto data = saved.str();
+      EXPECT(data.compare(0, 4, "TCRP") == 0);
+
+      auto loadFrom = [&](const std::string& bytes, bool lazy) {
+        {
+          std::ofstream out(path, std::ios::out | std::ios::binary);
+          out.write(bytes.data(), bytes.size());
+        }
+        Replayer r;
+        r.load(path, lazy);
+        return r.size();
+      };
+      EXPECT(loadFrom(data, false) == rep.size());
+      EXPECT_THROWS(loadFrom(data.substr(0, 20), false));
+      EXPECT_THROWS(loadFrom(data.substr(0, 32 + 16 * 8 + 4), false));
+      EXPECT_THROWS(loadFrom(data.substr(0, 32 + 16 * 8 + 4), true));
+      auto corrupted = data;
+      corrupted[13] ^= 1; // Map height
+      EXPECT_THROWS(loadFrom(corrupted, false));
+
+      // Frames that fail to decode are not cached
+      corrupted = data;
+      size_t size0;
+      std::memcpy(&size0, &corrupted[32 + 16 * 8], sizeof(size0));
+      auto diff1 = 32 + 16 * 8 + sizeof(size_t) + size0 + sizeof(size_t);
+      std::memset(&corrupted[diff1], 0xFF, 4); // Root table offset
+      {
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        out.write(corrupted.data(), corrupted.size());
+      }
+      Replayer lazy;
+      lazy.load(path, true);
+      EXPECT_THROWS(lazy.getFrame(1));
+      EXPECT_THROWS(lazy.getFrame(2));
+      EXPECT(detail::frameEq(lazy.getFrame(0), rep.getFrame(0)));
+      EXPECT_THROWS(lazy.getFrame(1));
+
+      // Version 0 header, as written by previous versions
+      std::ostringstream legacy;
+      legacy << "16 8 ";
+      legacy.write(reinterpret_cast<const char*>(mapData.data()), 16 * 8);
+      legacy << 2 << " ";
+      legacy << *rep.getFrame(0) << *rep.getFrame(1);
+      legacy << "1 0 12 ";
+      {
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        out << legacy.str();
+      }
+      Replayer old;
+      old.load(path);
+      EXPECT(old.size() == 2u);
+      EXPECT(old.getNumUnits(0) == 12);
+      EXPECT(old.mapWidth() == 8);
+      EXPECT(detail::frameEq(old.getFrame(1), rep.getFrame(1)));
+      std::remove(path);
+    }
+  },
+
+  lest_CASE("A MappedReplay exposes the tables of a saved replay") {
+    SETUP("Save a replay with keyframes, map it") {
+      const int numFrames = 12;
+      const char* path = "mapped_replay_test.tcr";
+      Replayer rep;
+      std::vector<uint8_t> mapData(16 * 8, 1);
+      rep.setRawMap(16, 8, mapData.data());
+      for (int t = 0; t < numFrames; t++) {
+        auto f = makeGameFrame(t);
+        rep.push(f);
+        f->decref();
+      }
+      rep.setKeyFrame(4);
+      rep.save(path);
+
+      {
+        MappedReplay mapped(path);
+        EXPECT(mapped.size() == rep.size());
+        EXPECT(mapped.mapWidth() == 8);
+        EXPECT(mapped.getRawMap()[5] == 1);
+        for (int i = 0; i < numFrames; i++) {
+          auto frame = rep.getFrame(i);
+          size_t numUnits = 0, numTableUnits = 0;
+          for (auto& player : frame->units) {
+            numUnits += player.second.size();
+          }
+          if (i % 4 == 0) {
+            EXPECT(mapped.getFrameDiffTable(i) == nullptr);
+            auto table = mapped.getFrameTable(i);
+            for (auto player : *table->units()) {
+              numTableUnits += player->units()->size();
+            }
+            EXPECT(table->reward() == frame->reward);
+          } else {
+            EXPECT(mapped.getFrameTable(i) == nullptr);
+            auto table = mapped.getFrameDiffTable(i);
+            for (auto player : *table->unitDiffContainers()) {
+              numTableUnits += player->units()->size();
+            }
+          }
+          EXPECT(numUnits == numTableUnits);
+        }
+      }
+      std::remove(path);
+    }
   }
 };
 
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Measures the time to diff and undiff frames of 2 to 8 players with players
+ * processed on a single thread and on pools of threads (see setDiffThreads()),
+ * to pick the unit count above which parallel diffs pay off.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "frame.h"
+
+using namespace torchcraft::replayer;
+
+namespace {
+
+const int kNumFrames = 16;
+
+Frame* makeFrame(int t, int numPlayers, int numUnits) {
+  auto f = new Frame();
+  for (int32_t pid = 0; pid < numPlayers; pid++) {
+    auto& units = f->units[pid];
+    for (int32_t id = 0; id < numUnits / numPlayers; id++) {
+      Unit u = Unit();
+      u.id = 1000 * pid + id;
+      u.playerId = pid;
+      u.health = 100;
+      u.pixel_x = 32 * id;
+      // About one unit in five moves, and one in twenty takes damage
+      if (id % 5 == 0) {
+        u.velocityX = 2;
+        u.pixel_x += 2 * t;
+      }
+      if (id % 20 == 0) {
+        u.health -= t;
+      }
+      u.x = u.pixel_x / 8;
+      f->setOrders(u, {{0, 1 + id % 3, -1, u.x, u.y}});
+      units.push_back(u);
+    }
+  }
+  f->units_sorted = true;
+  return f;
+}
+
+double run(int numPlayers, int numUnits, int rounds) {
+  std::vector<Frame*> frames;
+  for (int t = 0; t < kNumFrames; t++) {
+    frames.push_back(makeFrame(t, numPlayers, numUnits));
+  }
+  FrameDiff diff;
+  auto undiffed = new Frame();
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 1; i < frames.size(); i++) {
+      frame_diff(diff, frames[i], frames[i - 1]);
+      frame_undiff(undiffed, frames[i - 1], &diff);
+    }
+  }
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  undiffed->decref();
+  for (auto f : frames) {
+    f->decref();
+  }
+  return us / (rounds * (kNumFrames - 1));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : 100;
+  std::printf("%7s %5s", "players", "units");
+  for (int threads : {1, 2, 4}) {
+    std::printf("  %d thread(s) us", threads);
+  }
+  std::printf("\n");
+  for (int numPlayers : {2, 4, 8}) {
+    for (int numUnits : {200, 500, 1000, 2000, 4000}) {
+      std::printf("%7d %5d", numPlayers, numUnits);
+      for (int threads : {1, 2, 4}) {
+        setDiffThreads(threads, 0);
+        std::printf(" %16.2f", run(numPlayers, numUnits, rounds));
+      }
+      std::printf("\n");
+    }
+  }
+  setDiffThreads(1);
+  return 0;
+}
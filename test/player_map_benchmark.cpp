@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Compares PlayerMap with the std::unordered_map that Frame used before for
+ * its per-player data: copying the units and resources of a frame, diffing
+ * the units of two frames player by player, and iterating over all units.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "frame.h"
+
+using namespace torchcraft::replayer;
+
+namespace {
+
+const int kNumFrames = 64;
+const int kNumUnits = 100;
+
+template <template <typename> class Map>
+struct Layout {
+  Map<std::vector<Unit>> units;
+  Map<Resources> resources;
+};
+
+template <typename T>
+using HashMap = std::unordered_map<int32_t, T>;
+
+template <template <typename> class Map>
+std::vector<Layout<Map>> makeFrames() {
+  std::vector<Layout<Map>> frames(kNumFrames);
+  for (int t = 0; t < kNumFrames; t++) {
+    // Neutral units are listed under a player id of their own
+    for (int32_t pid : {0, 1, 11}) {
+      frames[t].resources[pid] = {50 + t, 10, 4, 10, 0, 0, 0};
+      auto& units = frames[t].units[pid];
+      for (int32_t id = 0; id < kNumUnits; id++) {
+        Unit u = Unit();
+        u.id = 1000 * pid + id;
+        u.x = id + t / 3;
+        u.y = id - t / 4;
+        u.health = 100 - (t + id) % 50;
+        u.playerId = pid;
+        units.push_back(u);
+      }
+    }
+  }
+  return frames;
+}
+
+// Same access pattern as frame_diff(): look up every player of lhs in rhs and
+// merge their units by id
+template <typename L>
+size_t diff(const L& lhs, const L& rhs) {
+  size_t changed = 0;
+  for (const auto& player : lhs.units) {
+    auto it = rhs.units.find(player.first);
+    if (it == rhs.units.end()) {
+      changed += player.second.size();
+      continue;
+    }
+    auto r = it->second.begin();
+    for (const auto& u : player.second) {
+      while (r != it->second.end() && r->id < u.id)
+        ++r;
+      if (r == it->second.end() || r->id != u.id || r->x != u.x ||
+          r->y != u.y || r->health != u.health)
+        changed++;
+    }
+    changed += lhs.resources.at(player.first).ore !=
+        rhs.resources.at(player.first).ore;
+  }
+  return changed;
+}
+
+template <typename L>
+size_t iterate(const L& f) {
+  size_t sum = 0;
+  for (const auto& player : f.units) {
+    for (const auto& u : player.second) {
+      sum += u.health;
+    }
+  }
+  return sum;
+}
+
+template <typename F>
+void run(const char* name, int rounds, F f) {
+  f(); // Warm up
+  size_t n = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    n += f();
+  }
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  std::printf(
+      "%-22s %10.3f us/frame (%zu)\n", name, us / rounds / kNumFrames, n);
+}
+
+template <template <typename> class Map>
+void runAll(const char* name, int rounds) {
+  auto frames = makeFrames<Map>();
+  std::string prefix(name);
+
+  run((prefix + " copy").c_str(), rounds, [&frames]() {
+    size_t n = 0;
+    for (const auto& f : frames) {
+      Layout<Map> copy(f);
+      n += copy.units.size();
+    }
+    return n;
+  });
+  run((prefix + " diff").c_str(), rounds, [&frames]() {
+    size_t n = 0;
+    for (size_t i = 1; i < frames.size(); i++) {
+      n += diff(frames[i], frames[i - 1]);
+    }
+    return n;
+  });
+  run((prefix + " iterate").c_str(), rounds, [&frames]() {
+    size_t n = 0;
+    for (const auto& f : frames) {
+      n += iterate(f);
+    }
+    return n;
+  });
+  run((prefix + " lookup").c_str(), rounds, [&frames]() {
+    size_t n = 0;
+    for (const auto& f : frames) {
+      for (int32_t pid = 0; pid < 12; pid++) {
+        n += f.units.count(pid) ? f.resources.at(pid).ore : 0;
+      }
+    }
+    return n;
+  });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : 200;
+  runAll<HashMap>("unordered_map", rounds);
+  runAll<PlayerMap>("PlayerMap", rounds);
+  return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Measures the word-wise unit comparison used by frame_diff(), for the scalar
+ * loop and the vectorized implementation selected at build time, and the
+ * time per frame_diff() call, on frames of 200 to 1500 units of which a
+ * fraction moves or takes damage from one frame to the next.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "frame.h"
+#include "unit_compare.h"
+
+using namespace torchcraft::replayer;
+
+namespace {
+
+const int kNumFrames = 32;
+
+Frame* makeFrame(int t, int numUnits) {
+  auto f = new Frame();
+  for (int32_t pid = 0; pid < 2; pid++) {
+    auto& units = f->units[pid];
+    for (int32_t id = 0; id < numUnits / 2; id++) {
+      Unit u = Unit();
+      u.id = 1000 * pid + id;
+      u.type = id % 7;
+      u.playerId = pid;
+      u.max_health = u.health = 100;
+      u.visible = 1;
+      u.flags = Unit::Flags::Completed;
+      u.pixel_x = 32 * id;
+      u.pixel_y = 32 * pid;
+      // About one unit in five moves, and one in twenty takes damage
+      if (id % 5 == 0) {
+        u.velocityX = 2;
+        u.pixel_x += 2 * t;
+        u.flags |= Unit::Flags::Moving;
+      }
+      if (id % 20 == 0) {
+        u.health -= t;
+      }
+      u.x = u.pixel_x / 8;
+      u.y = u.pixel_y / 8;
+      f->setOrders(u, {{0, 1 + id % 3, -1, u.x, u.y}});
+      units.push_back(u);
+    }
+  }
+  return f;
+}
+
+template <typename F>
+double run(std::vector<Frame*>& frames, int rounds, size_t& n, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 1; i < frames.size(); i++) {
+      n += f(frames[i], frames[i - 1]);
+    }
+  }
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+      (rounds * (frames.size() - 1));
+}
+
+template <uint64_t (*Compare)(const Unit&, const Unit&)>
+size_t compareFrames(Frame* f, Frame* prev) {
+  size_t n = 0;
+  for (const auto& player : f->units) {
+    const auto& units = player.second;
+    const auto& prevUnits = prev->units.at(player.first);
+    for (size_t i = 0; i < units.size(); i++) {
+      n += Compare(units[i], prevUnits[i]) != 0;
+    }
+  }
+  return n;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : 50;
+  std::printf(
+      "%6s %14s %14s %14s\n",
+      "units",
+      "scalar us/fr",
+      "vector us/fr",
+      "diff us/fr");
+  for (int numUnits : {200, 500, 1000, 1500}) {
+    std::vector<Frame*> frames;
+    for (int t = 0; t < kNumFrames; t++) {
+      frames.push_back(makeFrame(t, numUnits));
+    }
+
+    size_t n = 0;
+    run(frames, 1, n, compareFrames<detail::changedUnitWords>); // Warm up
+    double scalar = run(
+        frames, rounds, n, compareFrames<detail::changedUnitWordsScalar>);
+    double vector =
+        run(frames, rounds, n, compareFrames<detail::changedUnitWords>);
+    FrameDiff diff;
+    double diffs = run(frames, rounds, n, [&diff](Frame* f, Frame* prev) {
+      frame_diff(diff, f, prev);
+      return diff.units[0].size();
+    });
+    std::printf(
+        "%6d %14.2f %14.2f %14.2f (%zu)\n",
+        numUnits,
+        scalar,
+        vector,
+        diffs,
+        n);
+
+    for (auto f : frames) {
+      f->decref();
+    }
+  }
+  return 0;
+}
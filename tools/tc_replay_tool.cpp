@@ -0,0 +1,314 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Re-encodes replays in bulk: switches between plain and compressed files,
+ * changes the keyframe interval and upgrades files to the current format.
+ * Replays are streamed through a ReplayReader and a ReplayWriter, so every
+ * worker only holds a couple of frames in memory at a time.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "replayer.h"
+
+namespace tcr = torchcraft::replayer;
+
+namespace {
+
+enum class Compression { Keep, Zstd, Plain };
+
+struct Options {
+  std::string outDir;
+  size_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  int64_t keyframe = -1; // Keep
+  Compression compression = Compression::Keep;
+  bool predictive = false;
+  bool verbose = false;
+};
+
+struct Job {
+  std::string input;
+  std::string output;
+};
+
+struct Stats {
+  std::atomic<size_t> replays{0};
+  std::atomic<size_t> failed{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> bytesOut{0};
+};
+
+void usage(const char* prog) {
+  std::cerr
+      << "Usage: " << prog << " -o DIR [options] [FILE|DIR]...\n"
+      << "Re-encodes replays into DIR using the current replay format.\n"
+      << "Directories are searched recursively; their layout is kept.\n\n"
+      << "Options:\n"
+      << "  -o DIR   output directory\n"
+      << "  -l FILE  read input paths from FILE, one per line ('-' for stdin)\n"
+      << "  -j N     number of worker threads (default: number of cores)\n"
+      << "  -k N     keyframe interval (default: keep)\n"
+      << "  -z       compress output with Zstd\n"
+      << "  -p       write plain output\n"
+      << "  -P       predict unit positions from velocities in diffs\n"
+      << "  -v       report every replay\n"
+      << "  -h       show this help\n";
+}
+
+bool isDirectory(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+uint64_t fileSize(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+std::string baseName(const std::string& path) {
+  auto pos = path.find_last_of('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Creates all missing parent directories of path
+void makeParentDirs(const std::string& path) {
+  for (auto pos = path.find('/', 1); pos != std::string::npos;
+       pos = path.find('/', pos + 1)) {
+    auto dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      throw std::runtime_error("Cannot create directory " + dir);
+  }
+}
+
+void listDirectory(
+    const std::string& dir,
+    const std::string& rel,
+    std::vector<std::string>& files) {
+  auto d = opendir(dir.c_str());
+  if (d == nullptr)
+    throw std::runtime_error("Cannot open directory " + dir);
+  std::vector<std::string> names;
+  while (auto e = readdir(d)) {
+    if (std::strcmp(e->d_name, ".") != 0 && std::strcmp(e->d_name, "..") != 0)
+      names.push_back(e->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  for (const auto& name : names) {
+    if (isDirectory(dir + "/" + name)) {
+      listDirectory(dir + "/" + name, rel + name + "/", files);
+    } else {
+      files.push_back(rel + name);
+    }
+  }
+}
+
+bool isZstdFile(const std::string& path) {
+  const unsigned char magic[] = {0x28, 0xB5, 0x2F, 0xFD};
+  unsigned char data[4] = {0};
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  in.read(reinterpret_cast<char*>(data), 4);
+  return in.good() && std::memcmp(data, magic, 4) == 0;
+}
+
+// Returns the number of frames converted
+uint64_t convert(const Job& job, const Options& opts) {
+  tcr::ReplayReader reader(job.input);
+  uint32_t keyframe =
+      opts.keyframe < 0 ? reader.getKeyFrame() : uint32_t(opts.keyframe);
+  bool compressed = opts.compression == Compression::Keep
+      ? isZstdFile(job.input)
+      : opts.compression == Compression::Zstd;
+
+  // Write to a temporary file so that failures don't leave partial replays
+  auto tmp = job.output + ".tmp";
+  try {
+    tcr::ReplayWriter writer(tmp, keyframe, compressed);
+    writer.setPredictive(opts.predictive);
+    writer.setRawMap(
+        reader.mapHeight(), reader.mapWidth(), reader.getRawMap().data());
+    while (auto f = reader.next()) {
+      writer.push(f);
+    }
+    writer.close();
+  } catch (...) {
+    std::remove(tmp.c_str());
+    throw;
+  }
+  if (std::rename(tmp.c_str(), job.output.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Cannot rename output to " + job.output);
+  }
+  return reader.position();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opts;
+  std::vector<std::string> lists;
+  int c;
+  while ((c = getopt(argc, argv, "o:l:j:k:zpPvh")) != -1) {
+    switch (c) {
+      case 'o':
+        opts.outDir = optarg;
+        break;
+      case 'l':
+        lists.push_back(optarg);
+        break;
+      case 'j':
+        opts.numThreads = std::max(std::atoi(optarg), 1);
+        break;
+      case 'k':
+        opts.keyframe = std::max(std::atoi(optarg), 0);
+        break;
+      case 'z':
+        opts.compression = Compression::Zstd;
+        break;
+      case 'p':
+        opts.compression = Compression::Plain;
+        break;
+      case 'P':
+        opts.predictive = true;
+        break;
+      case 'v':
+        opts.verbose = true;
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (opts.outDir.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+  while (opts.outDir.size() > 1 && opts.outDir.back() == '/') {
+    opts.outDir.pop_back();
+  }
+
+  std::vector<std::string> inputs(argv + optind, argv + argc);
+  for (const auto& list : lists) {
+    std::ifstream file;
+    std::istream& in = list == "-" ? std::cin : file;
+    if (list != "-") {
+      file.open(list);
+      if (!file) {
+        std::cerr << "Cannot open file list " << list << std::endl;
+        return 2;
+      }
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      if (!line.empty())
+        inputs.push_back(line);
+    }
+  }
+
+  std::vector<Job> jobs;
+  try {
+    for (auto& input : inputs) {
+      if (isDirectory(input)) {
+        std::vector<std::string> files;
+        listDirectory(input, "", files);
+        for (const auto& file : files) {
+          jobs.push_back({input + "/" + file, opts.outDir + "/" + file});
+        }
+      } else {
+        jobs.push_back({input, opts.outDir + "/" + baseName(input)});
+      }
+    }
+    for (const auto& job : jobs) {
+      makeParentDirs(job.output);
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+  if (jobs.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  Stats stats;
+  std::mutex logMutex;
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (auto i = next++; i < jobs.size(); i = next++) {
+      const auto& job = jobs[i];
+      try {
+        if (job.input == job.output)
+          throw std::runtime_error("Refusing to overwrite input");
+        auto frames = convert(job, opts);
+        auto bytesIn = fileSize(job.input);
+        stats.frames += frames;
+        stats.bytesIn += bytesIn;
+        stats.bytesOut += fileSize(job.output);
+        stats.replays++;
+        if (opts.verbose) {
+          std::lock_guard<std::mutex> lock(logMutex);
+          std::cout << job.input << " -> " << job.output << ": " << frames
+                    << " frames, " << bytesIn << " bytes" << std::endl;
+        }
+      } catch (std::exception& e) {
+        stats.failed++;
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cerr << job.input << ": " << e.what() << std::endl;
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < std::min(opts.numThreads, jobs.size()); i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  double secs = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  secs = std::max(secs, 1e-9);
+
+  const double mb = 1024 * 1024;
+  std::printf(
+      "Converted %zu replays (%zu failed) with %zu threads in %.2fs\n"
+      "%llu frames, %.1f frames/s\n"
+      "%.1f MB read, %.1f MB/s; %.1f MB written\n",
+      stats.replays.load(),
+      stats.failed.load(),
+      threads.size(),
+      secs,
+      (unsigned long long)stats.frames.load(),
+      stats.frames / secs,
+      stats.bytesIn / mb,
+      stats.bytesIn / mb / secs,
+      stats.bytesOut / mb);
+  return stats.failed > 0 ? 1 : 0;
+}